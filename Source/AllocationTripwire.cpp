@@ -0,0 +1,141 @@
+/*
+ Heap allocation tripwire for the real-time threads
+
+ Authors:
+ Luca Bondi (luca.bondi@polimi.it)
+*/
+
+#include "AllocationTripwire.h"
+
+#if ESTICK_ALLOCATION_TRIPWIRE
+
+#include <new>
+#include <cstdlib>
+#if JUCE_WINDOWS && defined(_DEBUG)
+#include <crtdbg.h>
+#endif
+
+namespace {
+    /** Number of armed scopes of the thread. Trivially initialized, with initial-exec TLS on Linux the access never
+     calls back into the allocator */
+#if JUCE_LINUX
+    __attribute__((tls_model("initial-exec")))
+#endif
+    thread_local int armedDepth = 0;
+}
+
+// ==============================================================================
+AllocationTripwire::ScopedArm::ScopedArm() {
+    armedDepth++;
+}
+
+AllocationTripwire::ScopedArm::~ScopedArm() {
+    armedDepth--;
+}
+
+void AllocationTripwire::check() {
+    if (armedDepth > 0) {
+        /** Disarm first, so that reporting the assertion can allocate */
+        armedDepth = 0;
+        /** Heap allocation or deallocation on a real-time thread, look at the call stack */
+        jassertfalse;
+        std::abort();
+    }
+}
+
+// ==============================================================================
+void *operator new(std::size_t size) {
+    AllocationTripwire::check();
+    if (auto ptr = std::malloc(size > 0 ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+    AllocationTripwire::check();
+    return std::malloc(size > 0 ? size : 1);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &tag) noexcept {
+    return operator new(size, tag);
+}
+
+void operator delete(void *ptr) noexcept {
+    if (ptr != nullptr)
+        AllocationTripwire::check();
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+    operator delete(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept {
+    operator delete(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t) noexcept {
+    operator delete(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept {
+    operator delete(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept {
+    operator delete(ptr);
+}
+
+// ==============================================================================
+#if defined(__GLIBC__)
+
+/** JUCE and Eigen allocate with malloc. glibc exports its implementation under these names, so that the allocator
+ can be wrapped by symbol interposition */
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t num, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+
+void *malloc(size_t size) noexcept {
+    AllocationTripwire::check();
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t num, size_t size) noexcept {
+    AllocationTripwire::check();
+    return __libc_calloc(num, size);
+}
+
+void *realloc(void *ptr, size_t size) noexcept {
+    AllocationTripwire::check();
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) noexcept {
+    if (ptr != nullptr)
+        AllocationTripwire::check();
+    __libc_free(ptr);
+}
+}
+
+#elif JUCE_WINDOWS && defined(_DEBUG)
+
+namespace {
+    /** The debug runtime calls the hook for every malloc, realloc and free, its own bookkeeping excluded */
+    int crtAllocHook(int, void *, size_t, int blockType, long, const unsigned char *, int) {
+        if (blockType != _CRT_BLOCK)
+            AllocationTripwire::check();
+        return TRUE;
+    }
+
+    const auto previousCrtAllocHook = _CrtSetAllocHook(crtAllocHook);
+}
+
+#endif
+
+#endif
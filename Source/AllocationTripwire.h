@@ -0,0 +1,56 @@
+/*
+ Heap allocation tripwire for the real-time threads
+
+ Authors:
+ Luca Bondi (luca.bondi@polimi.it)
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+/** Define ESTICK_ALLOCATION_TRIPWIRE=1 in the preprocessor definitions to enable the tripwire */
+#ifndef ESTICK_ALLOCATION_TRIPWIRE
+#define ESTICK_ALLOCATION_TRIPWIRE 0
+#endif
+
+/** Test mode that fails as soon as a real-time thread touches the heap
+
+ When enabled, the global operator new and delete are replaced, together with malloc, calloc, realloc and free on
+ glibc and with an allocation hook on the Windows debug runtime. The replacements check whether the calling thread
+ is armed, and an allocation or a deallocation on an armed thread hits a jassert and aborts, so that the debugger or
+ the core dump points to the offending call. Elsewhere (macOS malloc) only operator new and delete are checked.
+
+ The audio thread is armed for the whole processBlock, and the beamformer workers while they process their tiles.
+ When disabled, ScopedArm is empty and the allocator is left untouched.
+
+ The replacements only take effect in an executable: the Standalone build and the test in Tests/TripwireTest, that
+ drives processBlock with automation, configuration changes and impulse responses, and fails on the first trip.
+ A plugin loaded by a host (VST3) is opened after the allocator is resolved, its calls bind to the allocator of the
+ host process and are never checked.
+ */
+class AllocationTripwire {
+
+public:
+
+    /** Arm the tripwire on the calling thread for the lifetime of this object. Scopes can be nested */
+    class ScopedArm {
+
+    public:
+#if ESTICK_ALLOCATION_TRIPWIRE
+        ScopedArm();
+        ~ScopedArm();
+#else
+        ScopedArm() {}
+#endif
+
+        JUCE_DECLARE_NON_COPYABLE(ScopedArm)
+    };
+
+    /** True if the tripwire is compiled in */
+    static constexpr bool isEnabled() { return ESTICK_ALLOCATION_TRIPWIRE != 0; }
+
+    /** Check an allocation or a deallocation by the calling thread. Called by the allocator replacements */
+    static void check();
+
+};
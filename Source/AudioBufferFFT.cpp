@@ -8,152 +8,148 @@
 #include "AudioBufferFFT.h"
 
 
-/** After each FFT, this function is called to allow convolution to be performed with only 4 SIMD functions calls.
-    Credits to juce_Convolution.cpp
- */
-void AudioBufferFFT::prepareForConvolution(float *samples, int fftSize) const {
-    int FFTSizeDiv2 = fftSize / 2;
-
-    for (size_t i = 0; i < FFTSizeDiv2; i++)
-        samples[i] = samples[2 * i];
-
-    samples[FFTSizeDiv2] = 0;
-
-    for (size_t i = 1; i < FFTSizeDiv2; i++)
-        samples[i + FFTSizeDiv2] = -samples[2 * (fftSize - i) + 1];
+AudioBufferFFT::AudioBufferFFT(int numChannels, std::shared_ptr<FFTBackend> &fft_) {
+    fft = fft_;
+    allocate(numChannels);
 }
 
-/** Does the convolution operation itself only on half of the frequency domain samples.
-    Credits to juce_Convolution.cpp*/
-void AudioBufferFFT::convolutionProcessingAndAccumulate(const float *input, const float *impulse, float *output,
-                                                        int fftSize) const {
-    int FFTSizeDiv2 = fftSize / 2;
-
-    FloatVectorOperations::addWithMultiply(output, input, impulse, FFTSizeDiv2);
-    FloatVectorOperations::subtractWithMultiply(output, &(input[FFTSizeDiv2]), &(impulse[FFTSizeDiv2]), FFTSizeDiv2);
-
-    FloatVectorOperations::addWithMultiply(&(output[FFTSizeDiv2]), input, &(impulse[FFTSizeDiv2]), FFTSizeDiv2);
-    FloatVectorOperations::addWithMultiply(&(output[FFTSizeDiv2]), &(input[FFTSizeDiv2]), impulse, FFTSizeDiv2);
-
-    output[fftSize] += input[fftSize] * impulse[fftSize];
+AudioBufferFFT::AudioBufferFFT(const AudioBuffer<float> &in_, std::shared_ptr<FFTBackend> &fft_) {
+    fft = fft_;
+    allocate(in_.getNumChannels());
+    setTimeSeries(in_);
 }
 
-/** Undo the re-organization of samples from the function prepareForConvolution.
-     Then, takes the conjugate of the frequency domain first half of samples, to fill the
-     second half, so that the inverse transform will return real samples in the time domain.
-     Credits to juce_Convolution.cpp
- */
-void AudioBufferFFT::updateSymmetricFrequencyDomainData(float *samples, int fftSize) const {
-    auto FFTSizeDiv2 = fftSize / 2;
-
-    for (size_t i = 1; i < FFTSizeDiv2; i++) {
-        samples[2 * (fftSize - i)] = samples[i];
-        samples[2 * (fftSize - i) + 1] = -samples[FFTSizeDiv2 + i];
+void AudioBufferFFT::allocate(int numChannels) {
+    numBins = fft->getNumBins();
+    binsStride = (numBins + ComplexMAC::granularity - 1) / ComplexMAC::granularity * ComplexMAC::granularity;
+    const int channelSize = 2 * binsStride;
+
+    spectrumData.calloc(numChannels * channelSize * sizeof(float) + ComplexMAC::alignment);
+    auto data = reinterpret_cast<float *>((reinterpret_cast<size_t>(spectrumData.get()) + ComplexMAC::alignment - 1)
+                                          & ~(size_t) (ComplexMAC::alignment - 1));
+    std::vector<float *> channels(numChannels);
+    realPointers.resize(numChannels);
+    imagPointers.resize(numChannels);
+    for (int channelIdx = 0; channelIdx < numChannels; ++channelIdx) {
+        channels[channelIdx] = data + channelIdx * channelSize;
+        realPointers[channelIdx] = channels[channelIdx];
+        imagPointers[channelIdx] = channels[channelIdx] + binsStride;
     }
+    setDataToReferTo(channels.data(), numChannels, channelSize);
 
-    samples[1] = 0.f;
-
-    for (size_t i = 1; i < FFTSizeDiv2; i++) {
-        samples[2 * i] = samples[2 * (fftSize - i)];
-        samples[2 * i + 1] = -samples[2 * (fftSize - i) + 1];
-    }
+    convBuffer = AudioBuffer<float>(1, fft->getSize());
+    fftScratch.calloc(fft->getScratchSize());
 }
 
-AudioBufferFFT::AudioBufferFFT(int numChannels, std::shared_ptr<dsp::FFT> &fft_) {
-    fft = fft_;
-    convBuffer = AudioBuffer<float>(1, fft->getSize() * 2);
-    setSize(numChannels, fft->getSize() * 2);
-}
-
-AudioBufferFFT::AudioBufferFFT(const AudioBuffer<float> &in_, std::shared_ptr<dsp::FFT> &fft_) {
-    fft = fft_;
-    convBuffer = AudioBuffer<float>(1, fft->getSize() * 2);
-    setSize(in_.getNumChannels(), fft->getSize() * 2);
-    setTimeSeries(in_);
+const float *AudioBufferFFT::inverseTransform(int channel) {
+    auto time = convBuffer.getWritePointer(0);
+    fft->performRealInverse(&realPointers[channel], &imagPointers[channel], &time, 1, fftScratch);
+    return time;
 }
 
 void AudioBufferFFT::reset() {
-    clear();
-    readyForConvolution = false;
+    for (int channelIdx = 0; channelIdx < getNumChannels(); ++channelIdx) {
+        FloatVectorOperations::clear(getRealWritePointer(channelIdx), getNumSamples());
+    }
 }
 
 void AudioBufferFFT::setTimeSeries(const AudioBuffer<float> &in_) {
     jassert(fft->getSize() >= in_.getNumSamples());
 
-    clear();
-    for (int channelIdx = 0; channelIdx < jmin(getNumChannels(), in_.getNumChannels()); ++channelIdx) {
-        copyFrom(channelIdx, 0, in_, channelIdx, 0, in_.getNumSamples());
-    }
-    // perform FFT
-    for (int channelIdx = 0; channelIdx < jmin(getNumChannels(), in_.getNumChannels()); ++channelIdx) {
-        fft->performRealOnlyForwardTransform(getWritePointer(channelIdx));
-    }
-
-    readyForConvolution = false;
+    reset();
+    fft->performRealForward(in_.getArrayOfReadPointers(), in_.getNumSamples(), realPointers.data(),
+                            imagPointers.data(), jmin(getNumChannels(), in_.getNumChannels()), fftScratch);
 }
 
-void AudioBufferFFT::updateSymmetricFrequency() {
-    if (readyForConvolution) {
-        for (int channelIdx = 0; channelIdx < getNumChannels(); ++channelIdx) {
-            updateSymmetricFrequencyDomainData(getWritePointer(channelIdx), fft->getSize());
+void AudioBufferFFT::setTimeSeries(const AudioBuffer<float> &in_, const int *channels, int numChannels) {
+    jassert(fft->getSize() >= in_.getNumSamples());
+
+    /** Gathered in small batches, so that the backend can still pair the channels */
+    const int batchSize = 8;
+    const float *in[batchSize];
+    float *re[batchSize];
+    float *im[batchSize];
+    for (int batchStart = 0; batchStart < numChannels; batchStart += batchSize) {
+        const int batchLen = jmin(batchSize, numChannels - batchStart);
+        for (int idx = 0; idx < batchLen; ++idx) {
+            const int channel = channels[batchStart + idx];
+            jassert(channel < getNumChannels() && channel < in_.getNumChannels());
+            in[idx] = in_.getReadPointer(channel);
+            re[idx] = realPointers[channel];
+            im[idx] = imagPointers[channel];
         }
-        readyForConvolution = false;
+        fft->performRealForward(in, in_.getNumSamples(), re, im, batchLen, fftScratch);
     }
 }
 
 void AudioBufferFFT::copyToTimeSeries(AudioBuffer<float> &out) {
-    updateSymmetricFrequency();
-    for (int channelIdx = 0; channelIdx < getNumChannels(); ++channelIdx) {
-        convBuffer.copyFrom(0, 0, *(this), channelIdx, 0, fft->getSize() * 2);
-        fft->performRealOnlyInverseTransform(convBuffer.getWritePointer(0));
-        out.copyFrom(channelIdx, 0, convBuffer, 0, 0, fft->getSize());
+    jassert(out.getNumChannels() >= getNumChannels() && out.getNumSamples() >= fft->getSize());
+    fft->performRealInverse(realPointers.data(), imagPointers.data(), out.getArrayOfWritePointers(),
+                            getNumChannels(), fftScratch);
+}
+
+void AudioBufferFFT::copyToTimeSeries(const int *channels, int numChannels, float *const *dest,
+                                      float *scratch) const {
+    /** Gathered in small batches, so that the backend can still pair the channels */
+    const int batchSize = 8;
+    const float *re[batchSize];
+    const float *im[batchSize];
+    for (int batchStart = 0; batchStart < numChannels; batchStart += batchSize) {
+        const int batchLen = jmin(batchSize, numChannels - batchStart);
+        for (int idx = 0; idx < batchLen; ++idx) {
+            jassert(channels[batchStart + idx] < getNumChannels());
+            re[idx] = realPointers[channels[batchStart + idx]];
+            im[idx] = imagPointers[channels[batchStart + idx]];
+        }
+        fft->performRealInverse(re, im, dest + batchStart, batchLen, scratch);
     }
 }
 
 void AudioBufferFFT::addToTimeSeries(AudioBuffer<float> &out) {
-    updateSymmetricFrequency();
     for (int channelIdx = 0; channelIdx < getNumChannels(); ++channelIdx) {
-        convBuffer.copyFrom(0, 0, *(this), channelIdx, 0, fft->getSize() * 2);
-        fft->performRealOnlyInverseTransform(convBuffer.getWritePointer(0));
-        out.addFrom(channelIdx, 0, convBuffer, 0, 0, fft->getSize());
+        out.addFrom(channelIdx, 0, inverseTransform(channelIdx), fft->getSize());
     }
 }
 
 void AudioBufferFFT::copyToTimeSeries(int sourceCh, AudioBuffer<float> &dest, int destCh) {
-    updateSymmetricFrequency();
-    convBuffer.copyFrom(0, 0, *(this), sourceCh, 0, fft->getSize() * 2);
-    fft->performRealOnlyInverseTransform(convBuffer.getWritePointer(0));
-    dest.copyFrom(destCh, 0, convBuffer, 0, 0, fft->getSize());
+    dest.copyFrom(destCh, 0, inverseTransform(sourceCh), fft->getSize());
 }
 
 void AudioBufferFFT::addToTimeSeries(int sourceCh, AudioBuffer<float> &dest, int destCh) {
-    updateSymmetricFrequency();
-    convBuffer.copyFrom(0, 0, *(this), sourceCh, 0, fft->getSize() * 2);
-    fft->performRealOnlyInverseTransform(convBuffer.getWritePointer(0));
-    dest.addFrom(destCh, 0, convBuffer, 0, 0, fft->getSize());
+    dest.addFrom(destCh, 0, inverseTransform(sourceCh), fft->getSize());
 }
 
-void AudioBufferFFT::prepareForConvolution() {
-    if (!readyForConvolution) {
-        for (int channelIdx = 0; channelIdx < getNumChannels(); ++channelIdx) {
-            prepareForConvolution(getWritePointer(channelIdx), fft->getSize());
-        }
-        readyForConvolution = true;
-    } else {
-        // prepareForConvolution should not be called if
-        jassertfalse;
-    }
+void AudioBufferFFT::copyToTimeSeries(int sourceCh, AudioBuffer<float> &dest, int destCh, int sourceStartSample,
+                                      int destStartSample, int numSamples) {
+    jassert(sourceStartSample + numSamples <= fft->getSize());
+    dest.copyFrom(destCh, destStartSample, inverseTransform(sourceCh) + sourceStartSample, numSamples);
 }
 
 void AudioBufferFFT::convolve(int outputChannel, const AudioBufferFFT &in_, int inChannel, AudioBufferFFT &filter_,
                               int filterChannel) {
 
-    jassert(in_.isReadyForConvolution());
-    jassert(filter_.isReadyForConvolution());
+    jassert(in_.binsStride == binsStride && filter_.binsStride == binsStride);
+
+    FloatVectorOperations::clear(getRealWritePointer(outputChannel), getNumSamples());
+    ComplexMAC::multiplyAccumulate(getRealWritePointer(outputChannel), getImagWritePointer(outputChannel),
+                                   in_.getRealPointer(inChannel), in_.getImagPointer(inChannel),
+                                   filter_.getRealPointer(filterChannel), filter_.getImagPointer(filterChannel),
+                                   binsStride);
+}
+
+void AudioBufferFFT::convolveAndAccumulate(int outputChannel, const AudioBufferFFT &in_, int inChannel,
+                                           const AudioBufferFFT &filter_, int filterChannel) {
 
-    clear(outputChannel, 0, getNumSamples());
-    convolutionProcessingAndAccumulate(in_.getReadPointer(inChannel), filter_.getReadPointer(filterChannel),
-                                       getWritePointer(outputChannel), fft->getSize());
+    jassert(in_.binsStride == binsStride && filter_.binsStride == binsStride);
+
+    ComplexMAC::multiplyAccumulate(getRealWritePointer(outputChannel), getImagWritePointer(outputChannel),
+                                   in_.getRealPointer(inChannel), in_.getImagPointer(inChannel),
+                                   filter_.getRealPointer(filterChannel), filter_.getImagPointer(filterChannel),
+                                   binsStride);
+}
 
-    readyForConvolution = true;
+void AudioBufferFFT::copySpectrum(int destChannel, const AudioBufferFFT &source, int sourceChannel) {
+    jassert(source.binsStride == binsStride);
+    FloatVectorOperations::copy(getRealWritePointer(destChannel), source.getRealPointer(sourceChannel),
+                                getNumSamples());
 }
@@ -8,20 +8,36 @@
 #pragma once
 
 #include "../JuceLibraryCode/JuceHeader.h"
+#include "ComplexMAC.h"
+#include "FFTBackend.h"
 
+/** Audio buffer in FFT domain
+
+ Each channel holds the non-negative frequency bins of the real FFT of a time series in split complex form:
+ getNumBins() real parts followed by as many imaginary parts, each array aligned to ComplexMAC::alignment bytes and
+ zero-padded to a multiple of ComplexMAC::granularity. Spectra are multiplied and accumulated in this layout with
+ no reorganization. Conversions from and to the time domain are performed by the FFT backend, all channels at once.
+ */
 class AudioBufferFFT : public AudioBuffer<float> {
 
 public:
     AudioBufferFFT() {};
 
-    AudioBufferFFT(int numChannels, std::shared_ptr<dsp::FFT> &);
+    AudioBufferFFT(int numChannels, std::shared_ptr<FFTBackend> &);
+
+    AudioBufferFFT(const AudioBuffer<float> &, std::shared_ptr<FFTBackend> &);
+
+    AudioBufferFFT(AudioBufferFFT &&) = default;
 
-    AudioBufferFFT(const AudioBuffer<float> &, std::shared_ptr<dsp::FFT> &);
+    AudioBufferFFT &operator=(AudioBufferFFT &&) = default;
 
     void reset();
 
     void setTimeSeries(const AudioBuffer<float> &);
 
+    /** Compute the spectra of a list of channels only, the other channels are left untouched */
+    void setTimeSeries(const AudioBuffer<float> &in_, const int *channels, int numChannels);
+
     void copyToTimeSeries(AudioBuffer<float> &);
 
     void copyToTimeSeries(int sourceCh, AudioBuffer<float> &dest, int destCh);
@@ -30,26 +46,71 @@ public:
 
     void addToTimeSeries(int sourceCh, AudioBuffer<float> &dest, int destCh);
 
+    /** Copy the time series of a list of channels to the destination
+
+     Uses the provided scratch memory, of at least getScratchSize() floats, so that disjoint sets of channels can be
+     transformed concurrently.
+     @param channels: channels to be transformed
+     @param dest: one pointer per listed channel, to at least the FFT size samples each
+     */
+    void copyToTimeSeries(const int *channels, int numChannels, float *const *dest, float *scratch) const;
+
+    /** Get the size of the scratch memory needed to transform a list of channels [floats] */
+    int getScratchSize() const { return fft->getScratchSize(); };
+
+    /** Copy a portion of the time series of a channel to the destination buffer */
+    void copyToTimeSeries(int sourceCh, AudioBuffer<float> &dest, int destCh, int sourceStartSample,
+                          int destStartSample, int numSamples);
+
     void
     convolve(int outputChannel, const AudioBufferFFT &in_, int inChannel, AudioBufferFFT &filter_, int filterChannel);
 
-    void prepareForConvolution();
+    /** Same as convolve, but the result is added to the spectrum already present in outputChannel
+     
+     Summing several inputs in the frequency domain needs a single inverse transform regardless of their number.
+     */
+    void convolveAndAccumulate(int outputChannel, const AudioBufferFFT &in_, int inChannel,
+                               const AudioBufferFFT &filter_, int filterChannel);
+
+    /** Copy the spectrum of a channel from another buffer */
+    void copySpectrum(int destChannel, const AudioBufferFFT &source, int sourceChannel);
 
-    bool isReadyForConvolution() const { return readyForConvolution; };
+    /** Number of non-negative frequency bins, DC and Nyquist included */
+    int getNumBins() const { return numBins; };
+
+    const float *getRealPointer(int channel) const { return getReadPointer(channel); };
+
+    const float *getImagPointer(int channel) const { return getReadPointer(channel, binsStride); };
+
+    /** Write access bypasses AudioBuffer, so that disjoint channels can be written concurrently */
+    float *getRealWritePointer(int channel) { return realPointers[channel]; };
+
+    float *getImagWritePointer(int channel) { return imagPointers[channel]; };
 
 private:
     AudioBuffer<float> convBuffer;
-    std::shared_ptr<dsp::FFT> fft;
+    std::shared_ptr<FFTBackend> fft;
 
-    void prepareForConvolution(float *samples, int fftSize) const;
+    /** Scratch memory for the FFT backend */
+    HeapBlock<float> fftScratch;
 
-    void convolutionProcessingAndAccumulate(const float *input, const float *impulse, float *output, int fftSize) const;
+    /** Channels storage, over-allocated to be aligned */
+    HeapBlock<char> spectrumData;
 
-    void updateSymmetricFrequencyDomainData(float *samples, int fftSize) const;
+    int numBins = 0;
 
-    void updateSymmetricFrequency();
+    /** Distance between the real and the imaginary parts of a channel [floats] */
+    int binsStride = 0;
 
-    bool readyForConvolution = false;
+    /** Real and imaginary parts of each channel, for batched transforms */
+    std::vector<float *> realPointers;
+    std::vector<float *> imagPointers;
 
-};
+    void allocate(int numChannels);
+
+    /** Transform a channel back to the time domain. The time series is available in convBuffer */
+    const float *inverseTransform(int channel);
 
+    JUCE_DECLARE_NON_COPYABLE (AudioBufferFFT);
+
+};
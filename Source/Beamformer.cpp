@@ -8,132 +8,613 @@
 #include "Beamformer.h"
 
 // ==============================================================================
-Beamformer::Beamformer(int numSources_, MicConfig mic, double sampleRate_, int maximumExpectedSamplesPerBlock_) {
+Beamformer::Beamformer(int numSources_, MicConfig mic, double sampleRate_, int blockSize_, int numWorkers,
+                       size_t steeringTableSize) {
     
     numSources = numSources_;
     micConfig = mic;
     sampleRate = sampleRate_;
-    maximumExpectedSamplesPerBlock = maximumExpectedSamplesPerBlock_;
     
-    /** Alpha for FIR update */
-    alpha = 1 - exp(-(maximumExpectedSamplesPerBlock / sampleRate) / firUpdateTimeConst);
-    
-    firIR.resize(numSources);
-    firFFT.resize(numSources);
+    useImpulseResponse.resize(numSources, false);
+    impulseResponses.resize(numSources);
+    micDelays.resize(numSources);
+    micGains.resize(numSources);
+    snapParams.resize(numSources, true);
+    sourceActive.resize(numSources, true);
+    beamParams.resize(numSources);
+    hasBeamParams.resize(numSources, false);
+    frozenParams.resize(numSources);
+    paramsSettled.resize(numSources, false);
+    /** Parameters that no FIR was designed for, so that the first ones are always different */
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    requestedParams.resize(numSources, {nan, nan, nan});
+    firParams.resize(numSources, {nan, nan, nan});
+    firPending.resize(numSources, false);
     
     /** Distance between microphones in eSticks*/
     const float micDistX = 0.03;
     const float micDistY = 0.03;
     
     /** Determine configuration parameters */
-    switch (micConfig) {
-        case ULA_1ESTICK:
-            numMic = 16;
-            numRows = 1;
-            break;
-        case ULA_2ESTICK:
-            numMic = 32;
-            numRows = 1;
-            break;
-        case URA_2ESTICK:
-            numMic = 32;
-            numRows = 2;
-            break;
-        case ULA_3ESTICK:
-            numMic = 48;
-            numRows = 1;
-            break;
-        case URA_3ESTICK:
-            numMic = 48;
-            numRows = 3;
-            break;
-        case ULA_4ESTICK:
-            numMic = 64;
-            numRows = 1;
-            break;
-        case URA_4ESTICK:
-            numMic = 64;
-            numRows = 4;
-            break;
-        case URA_2x2ESTICK:
-            numMic = 64;
-            numRows = 2;
-            break;
-    }
+    numMic = ::getNumMic(micConfig);
+    numRows = ::getNumRows(micConfig);
     alg = std::make_unique<DAS::FarfieldURA>(micDistX, micDistY, numMic, numRows, sampleRate, soundspeed);
     
     firLen = alg->getFirLen();
     
-    /** Create shared FFT object */
-    fft = std::make_shared<juce::dsp::FFT>(ceil(log2(firLen + maximumExpectedSamplesPerBlock - 1)));
+    if (numWorkers > 0) {
+        workerPool = std::make_unique<WorkerPool>(numWorkers);
+    }
     
-    /** Allocate FIR filters */
-    for (auto &f : firIR) {
-        f = AudioBuffer<float>(numMic, firLen);
-        f.clear();
+    /** Internal block size, also used as convolution partition size */
+    blockSize = blockSize_ > 0 ? blockSize_ : selectBlockSize();
+    
+    /** The convolution engines run a job per internal block */
+    if (workerPool != nullptr) {
+        workerPool->setJobPeriod(blockSize / sampleRate);
     }
-    for (auto &f : firFFT) {
-        f = AudioBufferFFT(numMic, fft);
-        f.clear();
+    
+    /** Alpha for delays and gains update, applied once per internal block */
+    alpha = 1 - exp(-(blockSize / sampleRate) / firUpdateTimeConst);
+    
+    /** Allocate the convolution engine */
+    convolution = std::make_unique<UniformPartitionedConvolution>(numSources, numMic, blockSize, firLen,
+                                                                  FFTBackend::defaultType, true);
+    convolution->setWorkerPool(workerPool.get());
+    setCrossfadeTime(crossfadeTime);
+    
+    /** Start the FIR designer. Initially all the FIRs are silent */
+    firDesigner = std::make_unique<FirDesigner>(*alg, *convolution, numSources, numMic, firLen,
+                                                getSteeringTable(steeringTableSize));
+    firDesigner->startThread(4);
+    
+    /** Allocate the fractional delay renderer */
+    fractionalDelay = std::make_unique<FractionalDelayRenderer>(numSources, numMic, firLen, blockSize);
+    
+    /** Allocate the variable delay renderer */
+    variableDelay = std::make_unique<VariableDelayRenderer>(numSources, numMic, firLen, blockSize);
+    for (auto srcIdx = 0; srcIdx < numSources; srcIdx++) {
+        micDelays[srcIdx] = Vec::Zero(numMic);
+        micGains[srcIdx] = Vec::Zero(numMic);
     }
     
-    /** Allocate input buffers */
-    inputBuffer = AudioBufferFFT(numSources, fft);
+    targetMicDelays = Vec::Zero(numMic);
+    targetMicGains = Vec::Zero(numMic);
     
-    /** Allocate convolution buffer */
-    convolutionBuffer = AudioBufferFFT(1, fft);
+    /** Allocate the FIFOs. The first internal block outputs silence */
+    inputFifo.setSize(numSources, blockSize);
+    inputFifo.clear();
+    outputFifo.setSize(numMic, blockSize);
+    outputFifo.clear();
     
-    /** Allocate  output buffer */
-    outBuffer.setSize(numMic, convolutionBuffer.getNumSamples() / 2);
-    outBuffer.clear();
+}
+
+int Beamformer::selectBlockSize() const {
+    
+    int maxBlockSize = minBlockSize;
+    while (maxBlockSize * 2 <= maxBlockDuration * sampleRate) {
+        maxBlockSize *= 2;
+    }
+    
+    /** Random FIRs and inputs, so that the timing does not depend on the content */
+    Random random(0);
+    AudioBuffer<float> fir(numMic, firLen);
+    for (auto micIdx = 0; micIdx < numMic; micIdx++) {
+        for (auto smpIdx = 0; smpIdx < firLen; smpIdx++) {
+            fir.setSample(micIdx, smpIdx, random.nextFloat() - 0.5f);
+        }
+    }
+    AudioBuffer<float> out(numMic, maxBlockSize);
+    AudioBuffer<float> in(numSources, maxBlockSize);
+    for (auto srcIdx = 0; srcIdx < numSources; srcIdx++) {
+        for (auto smpIdx = 0; smpIdx < maxBlockSize; smpIdx++) {
+            in.setSample(srcIdx, smpIdx, random.nextFloat() - 0.5f);
+        }
+    }
     
+    int bestBlockSize = minBlockSize;
+    double bestCost = std::numeric_limits<double>::max();
+    for (auto candidate = minBlockSize; candidate <= maxBlockSize; candidate *= 2) {
+        UniformPartitionedConvolution engine(numSources, numMic, candidate, firLen);
+        engine.setWorkerPool(workerPool.get());
+        for (auto srcIdx = 0; srcIdx < numSources; srcIdx++) {
+            engine.setImpulseResponse(srcIdx, fir);
+        }
+        const AudioBuffer<float> block(in.getArrayOfWritePointers(), numSources, candidate);
+        
+        /** One block to warm up the caches, then a fixed amount of samples */
+        const double period = candidate / sampleRate;
+        if (workerPool != nullptr) {
+            workerPool->setJobPeriod(period);
+        }
+        engine.process(block, out);
+        const int numBlocks = jmax(4, autotuneSamples / candidate);
+        const auto periodTicks = Time::secondsToHighResolutionTicks(period);
+        auto nextTick = Time::getHighResolutionTicks();
+        int64 processTicks = 0;
+        for (auto blockIdx = 0; blockIdx < numBlocks; blockIdx++) {
+            const auto startTick = Time::getHighResolutionTicks();
+            engine.process(block, out);
+            processTicks += Time::getHighResolutionTicks() - startTick;
+            
+            /** Workers are only kept awake by jobs arriving once per period, wait for the next one */
+            nextTick += periodTicks;
+            while (workerPool != nullptr && Time::getHighResolutionTicks() < nextTick) {
+                if (Time::highResolutionTicksToSeconds(nextTick - Time::getHighResolutionTicks()) > 2e-3) {
+                    Thread::sleep(1);
+                } else {
+                    Thread::yield();
+                }
+            }
+        }
+        const double cost = Time::highResolutionTicksToSeconds(processTicks) / (numBlocks * candidate);
+        
+        /** A longer block adds latency, worth it only for a clear improvement */
+        if (cost < 0.9 * bestCost) {
+            bestCost = cost;
+            bestBlockSize = candidate;
+        }
+    }
+    
+    return bestBlockSize;
 }
 
 Beamformer::~Beamformer() {
 }
 
+bool Beamformer::isSettled() const {
+    
+    /** The first internal block is silent, then the renderers need the FIRs length of past samples */
+    if (numSettlingSamples < blockSize + firLen)
+        return false;
+    
+    if (renderingMode != CONVOLUTION)
+        return true;
+    
+    for (auto srcIdx = 0; srcIdx < numSources; srcIdx++) {
+        if (hasBeamParams[srcIdx] && sourceActive[srcIdx] && !useImpulseResponse[srcIdx] &&
+            (firPending[srcIdx] || firParams[srcIdx] != beamParams[srcIdx]))
+            return false;
+    }
+    return true;
+}
+
 MicConfig Beamformer::getMicConfig() const {
     return micConfig;
 }
 
+void Beamformer::setRenderingMode(RenderingMode mode) {
+    if (mode == renderingMode)
+        return;
+    
+    renderingMode = mode;
+    if (renderingMode == FRACTIONAL_DELAY) {
+        fractionalDelay->reset();
+    } else if (renderingMode == VARIABLE_DELAY) {
+        variableDelay->reset();
+    }
+    
+    /** The convolution starts over from the FIRs fading in, the ones fading out are given back */
+    convolution->reset();
+    for (auto srcIdx = 0; srcIdx < numSources; srcIdx++) {
+        if (firPending[srcIdx]) {
+            firDesigner->releaseOldFir(srcIdx);
+            firPending[srcIdx] = false;
+        }
+    }
+    std::fill(snapParams.begin(), snapParams.end(), true);
+    std::fill(paramsSettled.begin(), paramsSettled.end(), false);
+}
+
+RenderingMode Beamformer::getRenderingMode() const {
+    return renderingMode;
+}
+
 void Beamformer::setParams(int srcIdx, const BeamParameters &params) {
-    if (alg == nullptr)
+    jassert(srcIdx < numSources);
+    if (trace != nullptr && (!hasBeamParams[srcIdx] || params != beamParams[srcIdx])) {
+        trace->record(TraceRecorder::instant, "Beam parameters change", srcIdx);
+    }
+    if (paramsFrozen && !hasBeamParams[srcIdx]) {
+        frozenParams[srcIdx] = params;
+    }
+    beamParams[srcIdx] = params;
+    hasBeamParams[srcIdx] = true;
+}
+
+void Beamformer::applyParams(int srcIdx, const BeamParameters &params) {
+    if (alg == nullptr || useImpulseResponse[srcIdx])
         return;
-    alg->getFir(firIR[srcIdx], params, alpha);
-    firFFT[srcIdx].setTimeSeries(firIR[srcIdx]);
-    firFFT[srcIdx].prepareForConvolution();
+    
+    if (renderingMode == FRACTIONAL_DELAY) {
+        /** Only delays and gains are needed, exponentially smoothed */
+        alg->getDelaysAndGains(targetMicDelays, targetMicGains, params);
+        if (snapParams[srcIdx]) {
+            micDelays[srcIdx] = targetMicDelays;
+            snapParams[srcIdx] = false;
+        }
+        micDelays[srcIdx] += alpha * (targetMicDelays - micDelays[srcIdx]);
+        micGains[srcIdx] += alpha * (targetMicGains - micGains[srcIdx]);
+        fractionalDelay->setDelaysAndGains(srcIdx, micDelays[srcIdx], micGains[srcIdx]);
+        /** Within 1% of the target, freezing here is inaudible */
+        paramsSettled[srcIdx] = (targetMicDelays - micDelays[srcIdx]).cwiseAbs().maxCoeff() < 1e-2f &&
+                                (targetMicGains - micGains[srcIdx]).cwiseAbs().maxCoeff() <
+                                1e-2f * targetMicGains.cwiseAbs().maxCoeff();
+    } else if (renderingMode == VARIABLE_DELAY) {
+        /** No smoothing, delays and gains are interpolated along the next block by the renderer */
+        alg->getDelaysAndGains(targetMicDelays, targetMicGains, params);
+        variableDelay->setDelaysAndGains(srcIdx, targetMicDelays, targetMicGains);
+        paramsSettled[srcIdx] = true;
+    } else {
+        /** FIRs are designed in the background only when the parameters change, then crossfaded by the
+         convolution engine. While a crossfade is in progress new FIRs wait for the next block */
+        if (params != requestedParams[srcIdx]) {
+            firDesigner->requestFir(srcIdx, params);
+            requestedParams[srcIdx] = params;
+            if (trace != nullptr) {
+                trace->record(TraceRecorder::instant, "FIR request", srcIdx);
+            }
+        }
+        if (!firPending[srcIdx] && (snapParams[srcIdx] || !convolution->isCrossfading())) {
+            if (const auto fir = firDesigner->takeNewFir(srcIdx, firParams[srcIdx])) {
+                if (trace != nullptr) {
+                    trace->record(TraceRecorder::instant, "FIR handover", srcIdx);
+                }
+                if (snapParams[srcIdx]) {
+                    convolution->setImpulseResponse(srcIdx, *fir);
+                    firDesigner->releaseOldFir(srcIdx);
+                } else {
+                    convolution->setPendingImpulseResponse(srcIdx, *fir);
+                    firPending[srcIdx] = true;
+                }
+                snapParams[srcIdx] = false;
+            }
+        }
+        /** Nothing to jump to if the FIRs in use are up to date */
+        if (firParams[srcIdx] == params) {
+            snapParams[srcIdx] = false;
+        }
+        paramsSettled[srcIdx] = firParams[srcIdx] == params;
+    }
+}
+
+void Beamformer::setCrossfadeTime(float seconds) {
+    crossfadeTime = seconds;
+    convolution->setCrossfadeLength(roundToInt(seconds * sampleRate));
 }
 
-void Beamformer::processBlock(const AudioBuffer<float> &inBuffer) {
+void Beamformer::setParamsFrozen(bool frozen) {
+    if (frozen && !paramsFrozen) {
+        std::copy(beamParams.begin(), beamParams.end(), frozenParams.begin());
+        std::fill(paramsSettled.begin(), paramsSettled.end(), false);
+    }
+    paramsFrozen = frozen;
+}
+
+void Beamformer::setSourceActive(int srcIdx, bool active) {
+    jassert(srcIdx < numSources);
+    if (active && !sourceActive[srcIdx]) {
+        /** Parameters may have changed while gated, no point in smoothing from the old ones */
+        snapParams[srcIdx] = true;
+        paramsSettled[srcIdx] = false;
+    }
+    sourceActive[srcIdx] = active;
+}
+
+void Beamformer::processBlock(AudioBuffer<float> &buffer) {
+    processBlock(buffer, 0, buffer.getNumSamples());
+}
+
+void Beamformer::processBlock(AudioBuffer<float> &buffer, int blockStartSample, int numSamples) {
+    
+    TraceRecorder::ScopedEvent blockEvent(trace, "Beamformer::processBlock", numSamples);
+    
+    jassert(blockStartSample >= 0 && blockStartSample + numSamples <= buffer.getNumSamples());
+    const int numOutputs = jmin(numMic, buffer.getNumChannels());
+    const int blockEndSample = blockStartSample + numSamples;
+    
+    for (auto startSample = blockStartSample; startSample < blockEndSample;) {
+        const int numChunkSamples = jmin(blockEndSample - startSample, blockSize - fifoPos);
+        
+        /** Move the sources to the input FIFO, then replace them with the microphones of the previous block */
+        const auto copyStartTicks = profiler != nullptr ? Time::getHighResolutionTicks() : 0;
+        for (auto srcIdx = 0; srcIdx < numSources; srcIdx++) {
+            if (srcIdx < buffer.getNumChannels()) {
+                inputFifo.copyFrom(srcIdx, fifoPos, buffer, srcIdx, startSample, numChunkSamples);
+            } else {
+                inputFifo.clear(srcIdx, fifoPos, numChunkSamples);
+            }
+        }
+        for (auto outCh = 0; outCh < numOutputs; outCh++) {
+            buffer.copyFrom(outCh, startSample, outputFifo, outCh, fifoPos, numChunkSamples);
+        }
+        if (profiler != nullptr) {
+            profiler->record(Profiler::fifoCopy, copyStartTicks, Time::getHighResolutionTicks());
+        }
         
-    /** Compute inputs FFT */
-    inputBuffer.setTimeSeries(inBuffer);
-    inputBuffer.prepareForConvolution();
+        fifoPos += numChunkSamples;
+        startSample += numChunkSamples;
+        if (fifoPos == blockSize) {
+            processInternalBlock();
+            fifoPos = 0;
+        }
+    }
+    
+    for (auto outCh = numMic; outCh < buffer.getNumChannels(); outCh++) {
+        buffer.clear(outCh, blockStartSample, numSamples);
+    }
     
+    numSettlingSamples = jmin(blockSize + firLen, numSettlingSamples + numSamples);
+    
+}
+
+void Beamformer::processInternalBlock() {
+    
+    /** FIRs faded out are not used anymore */
+    if (!convolution->isCrossfading()) {
+        for (auto srcIdx = 0; srcIdx < numSources; srcIdx++) {
+            if (firPending[srcIdx]) {
+                firDesigner->releaseOldFir(srcIdx);
+                firPending[srcIdx] = false;
+            }
+        }
+    }
+    
+    /** Gated sources are silent, their parameters are not worth updating. Frozen ones stop once settled */
+    const auto paramsStartTicks = profiler != nullptr ? Time::getHighResolutionTicks() : 0;
     for (auto srcIdx = 0; srcIdx < numSources; srcIdx++) {
-        for (auto outCh = 0; outCh < numMic; outCh++) {
-            /** Convolve inputs and FIR */
-            convolutionBuffer.convolve(0, inputBuffer, srcIdx, firFFT[srcIdx], outCh);
-            /** Overlap and add of convolutionBuffer into beamBuffer */
-            convolutionBuffer.addToTimeSeries(0, outBuffer, outCh);
+        if (hasBeamParams[srcIdx] && sourceActive[srcIdx] && !(paramsFrozen && paramsSettled[srcIdx])) {
+            applyParams(srcIdx, paramsFrozen ? frozenParams[srcIdx] : beamParams[srcIdx]);
+        }
+    }
+    if (profiler != nullptr) {
+        profiler->record(Profiler::beamParameters, paramsStartTicks, Time::getHighResolutionTicks());
+    }
+    
+    const AudioBuffer<float> &in = inputFifo;
+    AudioBuffer<float> &out = outputFifo;
+    
+    if (renderingMode == FRACTIONAL_DELAY) {
+        /** Delay and scale the inputs, summing all the sources for each microphone */
+        Profiler::ScopedTimer timer(profiler, Profiler::delayRendering);
+        fractionalDelay->process(in, out);
+    } else if (renderingMode == VARIABLE_DELAY) {
+        /** Delay and scale the inputs with per-sample interpolated delays and gains */
+        Profiler::ScopedTimer timer(profiler, Profiler::delayRendering);
+        variableDelay->process(in, out);
+    } else {
+        /** Convolve inputs and FIR, summing all the sources for each microphone */
+        convolution->process(in, out);
+    }
+    
+    /** Add the sources rendered through impulse responses */
+    if (irConvolution != nullptr) {
+        irConvolution->processAndAccumulate(in, out);
+    }
+    
+}
+
+void Beamformer::setMaxSamplesPerBlock(int numSamples) {
+    maxSamplesPerBlock = numSamples;
+}
+
+void Beamformer::setImpulseResponse(int srcIdx, const AudioBuffer<float> &ir) {
+    jassert(srcIdx < numSources);
+    
+    impulseResponses[srcIdx].makeCopyOf(ir);
+    useImpulseResponse[srcIdx] = true;
+    
+    /** Silence the beamforming FIRs and delay lines of the source */
+    AudioBuffer<float> silence(numMic, 1);
+    silence.clear();
+    convolution->setImpulseResponse(srcIdx, silence);
+    micGains[srcIdx].setZero();
+    fractionalDelay->setDelaysAndGains(srcIdx, micDelays[srcIdx], micGains[srcIdx]);
+    variableDelay->setDelaysAndGains(srcIdx, micDelays[srcIdx], micGains[srcIdx]);
+    
+    if (irConvolution == nullptr || irConvolution->getIrLen() < ir.getNumSamples()) {
+        /** Allocate an engine long enough for all the impulse responses in use */
+        int irLen = 0;
+        for (auto idx = 0; idx < numSources; idx++) {
+            if (useImpulseResponse[idx]) {
+                irLen = jmax(irLen, impulseResponses[idx].getNumSamples());
+            }
+        }
+        /** Internal blocks are processed in a row, up to a host block plus an internal block */
+        irConvolution.reset();
+        irConvolution = std::make_unique<NonUniformPartitionedConvolution>(numSources, numMic, blockSize, irLen,
+                                                                           maxSamplesPerBlock + blockSize);
+        irConvolution->setWorkerPool(workerPool.get());
+        for (auto idx = 0; idx < numSources; idx++) {
+            if (useImpulseResponse[idx]) {
+                irConvolution->setImpulseResponse(idx, impulseResponses[idx]);
+            }
         }
+    } else {
+        irConvolution->setImpulseResponse(srcIdx, ir);
     }
+}
+
+void Beamformer::clearImpulseResponse(int srcIdx) {
+    jassert(srcIdx < numSources);
+    
+    if (!useImpulseResponse[srcIdx])
+        return;
+    
+    useImpulseResponse[srcIdx] = false;
+    impulseResponses[srcIdx].setSize(0, 0);
     
+    /** Back to the most recent FIRs. Parameters may have changed in the meantime, no point in fading */
+    if (firPending[srcIdx]) {
+        firDesigner->releaseOldFir(srcIdx);
+        firPending[srcIdx] = false;
+    }
+    convolution->setImpulseResponse(srcIdx, firDesigner->getFir(srcIdx));
+    snapParams[srcIdx] = true;
+    paramsSettled[srcIdx] = false;
+    
+    if (std::find(useImpulseResponse.begin(), useImpulseResponse.end(), true) == useImpulseResponse.end()) {
+        /** No more sources rendered through impulse responses */
+        irConvolution.reset();
+    } else {
+        irConvolution->setImpulseResponse(srcIdx, impulseResponses[srcIdx]);
+    }
 }
 
 void Beamformer::getFir(AudioBuffer<float> &fir, const BeamParameters &params, float alpha) const {
     alg->getFir(fir, params, alpha);
 }
 
-void Beamformer::getOutput(AudioBuffer<float> &dst) {
-    auto numSplsOut = dst.getNumSamples();
-    auto numSplsShift = outBuffer.getNumSamples() - numSplsOut;
-    for (auto outCh = 0; outCh < jmin(numMic,dst.getNumChannels()); outCh++) {
-        /** Copy beamBuffer to outBuffer */
-        dst.copyFrom(outCh, 0, outBuffer, outCh, 0, numSplsOut);
-        /** Shift beamBuffer */
-        FloatVectorOperations::copy(outBuffer.getWritePointer(outCh),
-                                    outBuffer.getReadPointer(outCh) + numSplsOut, numSplsShift);
-        outBuffer.clear(outCh, numSplsShift, outBuffer.getNumSamples() - numSplsShift);
+void Beamformer::setProfiler(Profiler *profiler_) {
+    profiler = profiler_;
+    trace = profiler != nullptr ? &profiler->getTraceRecorder() : nullptr;
+    convolution->setProfiler(profiler);
+    firDesigner->setProfiler(profiler);
+}
+
+
+// ==============================================================================
+Beamformer::SteeringTable::SteeringTable(const BeamformingAlgorithm &alg, const UniformPartitionedConvolution &engine,
+                                         MicConfig config_, float sampleRate_, size_t size_)
+        : config(config_), sampleRate(sampleRate_), blockSize(engine.getPartitionSize()), size(size_) {
+    
+    /** Finest power of 2 resolution within the memory budget */
+    const auto delayRange = alg.getDelayRange();
+    auto getNumDelays = [delayRange](int resolution) {
+        return (int) ceil(delayRange.getLength() * resolution) + 2;
+    };
+    resolution = maxResolution;
+    while (resolution > 0 && getNumDelays(resolution) * engine.getImpulseResponseSize() > size) {
+        resolution /= 2;
+    }
+    if (resolution == 0)
+        return;
+    
+    /** Unit gain FIRs, designed a batch of delays at a time, then transformed all at once */
+    start = delayRange.getStart();
+    len = getNumDelays(resolution);
+    AudioBuffer<float> delayFirs(len, alg.getFirLen());
+    const int batchSize = 256;
+    for (auto startIdx = 0; startIdx < len; startIdx += batchSize) {
+        const int numBatchDelays = jmin(batchSize, len - startIdx);
+        Vec delays(numBatchDelays);
+        for (auto idx = 0; idx < numBatchDelays; idx++) {
+            delays(idx) = start + float(startIdx + idx) / resolution;
+        }
+        AudioBuffer<float> batch(delayFirs.getArrayOfWritePointers() + startIdx, numBatchDelays, alg.getFirLen());
+        alg.getDelayFirs(batch, delays);
+    }
+    firs = std::make_unique<UniformPartitionedConvolution::ImpulseResponse>(engine, len);
+    firs->set(delayFirs);
+}
+
+std::shared_ptr<const Beamformer::SteeringTable> Beamformer::getSteeringTable(size_t size) const {
+    /** Tables held by any beamformer, of any processor instance. Computed under the lock, so that two beamformers
+     built at the same time don't compute the same table twice */
+    static CriticalSection cacheLock;
+    static std::vector<std::weak_ptr<const SteeringTable>> cache;
+    
+    const ScopedLock lock(cacheLock);
+    for (auto it = cache.begin(); it != cache.end();) {
+        auto table = it->lock();
+        if (table == nullptr) {
+            it = cache.erase(it);
+            continue;
+        }
+        if (table->config == micConfig && table->sampleRate == sampleRate && table->blockSize == blockSize &&
+            table->size == size) {
+            return table;
+        }
+        ++it;
+    }
+    std::shared_ptr<const SteeringTable> table = std::make_shared<SteeringTable>(*alg, *convolution, micConfig,
+                                                                                 sampleRate, size);
+    cache.push_back(table);
+    return table;
+}
+
+// ==============================================================================
+Beamformer::FirDesigner::FirDesigner(const BeamformingAlgorithm &alg_, const UniformPartitionedConvolution &engine,
+                                     int numSources, int numMic_, int firLen,
+                                     std::shared_ptr<const SteeringTable> steeringTable_)
+        : Thread("FIR designer"), alg(alg_), numMic(numMic_), steeringTable(std::move(steeringTable_)) {
+    
+    for (auto srcIdx = 0; srcIdx < numSources; srcIdx++) {
+        auto source = std::make_unique<Source>();
+        for (auto &f : source->firs) {
+            f = std::make_unique<UniformPartitionedConvolution::ImpulseResponse>(engine);
+        }
+        sources.push_back(std::move(source));
+    }
+    fir.setSize(numMic, firLen);
+}
+
+Beamformer::FirDesigner::~FirDesigner() {
+    stopThread(1000);
+}
+
+void Beamformer::FirDesigner::run() {
+    while (!threadShouldExit()) {
+        for (auto &source : sources) {
+            if (source->paramsExchange.acquire(source->paramsReadSlot)) {
+                const auto &params = source->params[source->paramsReadSlot];
+                {
+                    Profiler::ScopedTimer timer(profiler.load(), Profiler::firDesign);
+                    design(*source->firs[source->firDesignSlot], params);
+                }
+                source->firParams[source->firDesignSlot] = params;
+                source->firExchange.publish(source->firDesignSlot);
+            }
+        }
+        wait(pollInterval);
+    }
+}
+
+void Beamformer::FirDesigner::design(UniformPartitionedConvolution::ImpulseResponse &dest,
+                                     const BeamParameters &params) {
+    if (steeringTable == nullptr || steeringTable->firs == nullptr) {
+        alg.getFir(fir, params);
+        dest.set(fir);
+        return;
     }
+    
+    /** Linear interpolation between the FIRs of the two closest delays */
+    alg.getDelaysAndGains(micDelays, micGains, params);
+    for (auto micIdx = 0; micIdx < numMic; micIdx++) {
+        const float pos = jlimit(0.f, float(steeringTable->len - 1),
+                                 (micDelays(micIdx) - steeringTable->start) * steeringTable->resolution);
+        const int delayIdx = jmin((int) pos, steeringTable->len - 2);
+        const float frac = pos - delayIdx;
+        const float weights[2] = {micGains(micIdx) * (1 - frac), micGains(micIdx) * frac};
+        dest.setWeightedSum(micIdx, *steeringTable->firs, delayIdx, weights, 2);
+    }
+}
+
+void Beamformer::FirDesigner::setProfiler(Profiler *profiler_) {
+    profiler = profiler_;
+}
+
+void Beamformer::FirDesigner::requestFir(int srcIdx, const BeamParameters &params) {
+    auto &source = *sources[srcIdx];
+    source.params[source.paramsWriteSlot] = params;
+    source.paramsExchange.publish(source.paramsWriteSlot);
+}
+
+const UniformPartitionedConvolution::ImpulseResponse *
+Beamformer::FirDesigner::takeNewFir(int srcIdx, BeamParameters &params) {
+    auto &source = *sources[srcIdx];
+    if (!source.firExchange.acquire(source.firSpareSlot))
+        return nullptr;
+    params = source.firParams[source.firSpareSlot];
+    return source.firs[source.firSpareSlot].get();
+}
+
+void Beamformer::FirDesigner::releaseOldFir(int srcIdx) {
+    auto &source = *sources[srcIdx];
+    std::swap(source.firCurrentSlot, source.firSpareSlot);
+}
+
+const UniformPartitionedConvolution::ImpulseResponse &Beamformer::FirDesigner::getFir(int srcIdx) const {
+    const auto &source = *sources[srcIdx];
+    return *source.firs[source.firCurrentSlot];
 }
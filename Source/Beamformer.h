@@ -9,8 +9,10 @@
 
 #include "../JuceLibraryCode/JuceHeader.h"
 #include "eStickSimDefs.h"
-#include "AudioBufferFFT.h"
+#include "PartitionedConvolution.h"
+#include "FractionalDelay.h"
 #include "BeamformingAlgorithms.h"
+#include "SlotExchange.h"
 
 
 
@@ -27,33 +29,113 @@ public:
 
 
     /** Initialize the Beamformer with a set of static parameters.
+     
+     Processing runs on internal blocks of fixed size, regardless of the size of the blocks provided by the host.
      @param numBeams: number of beams the beamformer has to compute
      @param mic: microphone configuration
      @param sampleRate:
-     @param maximumExpectedSamplesPerBlock: 
+     @param blockSize: internal block size, equal to the convolution partition size [samples], power of 2.
+                       0 to select the fastest one within maxBlockDuration
+     @param numWorkers: number of worker threads sharing the convolution with the audio thread
+     @param steeringTableSize: memory budget for the steering table of the FIR designer [bytes].
+                               0 to design each FIR from scratch
      */
-    Beamformer(int numBeams, MicConfig mic, double sampleRate, int maximumExpectedSamplesPerBlock);
+    Beamformer(int numBeams, MicConfig mic, double sampleRate, int blockSize = 0, int numWorkers = 0,
+               size_t steeringTableSize = defaultSteeringTableSize);
 
     /** Destructor. */
     ~Beamformer();
     
+    /** Default memory budget for the steering table of the FIR designer [bytes] */
+    static const size_t defaultSteeringTableSize = 16 << 20;
+    
     /** Get microphone configuration */
     MicConfig getMicConfig() const;
-
-    /** Process a new block of samples.
+    
+    /** Get the number of microphones */
+    int getNumMic() const { return numMic; };
+    
+    /** Whether the output is complete
      
-     To be called inside AudioProcessor::processBlock.
+     A new beamformer is settled once the internal blocks hold enough past samples for the FIRs and, in convolution
+     mode, once the FIRs in use match the latest parameters of the active sources.
      */
-    void processBlock(const AudioBuffer<float> &inBuffer);
+    bool isSettled() const;
+    
+    /** Set the rendering mode
+     
+     Changing mode resets the state of the newly selected renderer.
+     */
+    void setRenderingMode(RenderingMode mode);
+    
+    /** Get the rendering mode */
+    RenderingMode getRenderingMode() const;
 
-    /** Copy the current beams outputs to the provided output buffer
+    /** Process a new block of samples, in place.
      
-     To be called inside AudioProcessor::processBlock, after Beamformer::processBlock
+     To be called inside AudioProcessor::processBlock. Any number of samples is supported.
+     The first channels of buffer hold the sources. All the channels are replaced by the microphones signals,
+     delayed by getLatencySamples(). Channels beyond the number of microphones are cleared.
      */
-    void getOutput(AudioBuffer<float> &outBuffer);
+    void processBlock(AudioBuffer<float> &buffer);
+
+    /** Process numSamples samples of buffer from startSample, in place. The other samples are left untouched */
+    void processBlock(AudioBuffer<float> &buffer, int startSample, int numSamples);
 
-    /** Set the parameters for a specific beam  */
+    /** Set the parameters for a specific beam
+     
+     Parameters are applied at the beginning of the next internal block. In convolution mode the FIRs are designed
+     on a background thread, then faded in at the beginning of the first internal block after they are ready.
+     */
     void setParams(int beamIdx, const BeamParameters &beamParams);
+    
+    /** Set the crossfade time from the old FIRs to the new ones, when parameters change
+     
+     @param seconds: crossfade time [s], applied from the next parameters change
+     */
+    void setCrossfadeTime(float seconds);
+    
+    /** Freeze the parameters of the sources, to save processing under load
+     
+     While frozen, sources are rendered with the parameters they had when freezing: once their FIRs are in use, or
+     their delays and gains are reached, no FIRs are designed or crossfaded and no delays and gains are computed.
+     Sources with no parameters yet still get their first ones. The latest parameters are reached once unfrozen.
+     */
+    void setParamsFrozen(bool frozen);
+    
+    /** Gate a source
+     
+     The samples of an inactive source must be zeros. Its parameters are not updated, the convolution engine skips
+     it as soon as the contribution of its past samples has been played.
+     */
+    void setSourceActive(int srcIdx, bool active);
+    
+    /** Get the internal block size [samples] */
+    int getBlockSize() const { return blockSize; };
+    
+    /** Get the latency introduced by the internal blocks [samples] */
+    int getLatencySamples() const { return blockSize; };
+
+    /** Set the largest number of samples given to processBlock, so that the tail of long impulse responses is
+     computed in time. Applied from the next setImpulseResponse
+     */
+    void setMaxSamplesPerBlock(int numSamples);
+    
+    /** Render a source through a set of impulse responses instead of the beamforming FIRs
+     
+     Long impulse responses (e.g. measured in a room) are convolved with a non-uniformly partitioned engine.
+     Not real-time safe, the beamformer must not be processed meanwhile: meant for a beamformer being built, that
+     is then faded in as for a configuration change.
+     @param srcIdx: source index
+     @param ir: impulse responses, one channel per microphone
+     */
+    void setImpulseResponse(int srcIdx, const AudioBuffer<float> &ir);
+
+    /** Go back to the beamforming FIRs for a source
+     
+     Not real-time safe, the beamformer must not be processed meanwhile.
+     */
+    void clearImpulseResponse(int srcIdx);
 
     /** Get FIR in time domain for a given direction of arrival
     
@@ -63,6 +145,13 @@ public:
     */
     void getFir(AudioBuffer<float> &fir, const BeamParameters &params, float alpha = 1) const;
 
+    /** Record the timings of the processing stages, FIR design included
+
+     To be called while the processing is suspended.
+     @param profiler: nullptr to stop recording
+     */
+    void setProfiler(Profiler *profiler);
+
 
 private:
 
@@ -74,8 +163,19 @@ private:
     /** Sample rate [Hz] */
     float sampleRate = 48000;
 
-    /** Maximum buffer size [samples] */
-    int maximumExpectedSamplesPerBlock = 64;
+    /** Internal block size [samples] */
+    int blockSize;
+    
+    /** Largest number of samples given to processBlock, 0 if unknown [samples] */
+    int maxSamplesPerBlock = 0;
+    
+    /** Internal block size bounds for the automatic selection */
+    const int minBlockSize = 32;
+    const float maxBlockDuration = 0.02;
+    
+    /** Minimum number of samples processed by each candidate during the automatic selection. With workers the
+     blocks are paced in real time, this is about 0.1 s per candidate */
+    const int autotuneSamples = 4096;
 
     /** Number of microphones */
     int numMic = 16;
@@ -92,32 +192,246 @@ private:
     /** FIR filters length. Diepends on the algorithm */
     int firLen;
 
-    /** Shared FFT pointer */
-    std::shared_ptr<juce::dsp::FFT> fft;
+    /** Unit gain FIRs on a uniform grid of delays, in the format of the convolution engine
+
+     Read-only once computed, shared by all the beamformers with the same microphone configuration, sample rate,
+     block size and memory budget, from any processor instance.
+     */
+    struct SteeringTable {
+        /** Compute the table with the finest power of 2 resolution within the memory budget */
+        SteeringTable(const BeamformingAlgorithm &alg, const UniformPartitionedConvolution &engine,
+                      MicConfig config, float sampleRate, size_t size);
+
+        /** Settings the table was computed for */
+        MicConfig config;
+        float sampleRate;
+        int blockSize;
+        size_t size;
+
+        /** Finest resolution [FIRs per sample of delay] */
+        static const int maxResolution = 64;
+
+        /** Resolution [FIRs per sample of delay] */
+        int resolution = 0;
+
+        /** Delay of the first FIR [samples] */
+        float start = 0;
+
+        /** Number of delays */
+        int len = 0;
+
+        /** FIRs, one channel per delay. nullptr if the budget doesn't fit any */
+        std::unique_ptr<UniformPartitionedConvolution::ImpulseResponse> firs;
+
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SteeringTable);
+    };
+
+    /** Get the steering table for this beamformer, computing it only if no other beamformer holds it */
+    std::shared_ptr<const SteeringTable> getSteeringTable(size_t size) const;
+
+    /** Designs the FIRs of all the sources on a background thread, as spectra ready for the convolution engine.
+
+     Each microphone FIR is a windowed fractional delay scaled by its gain. Unit gain FIRs are precomputed on a
+     uniform grid of delays, already in the format of the convolution engine, so that each FIR is designed by
+     interpolating between the two closest delays in the frequency domain, with no transform at all.
+     Interpolating between neighbouring delays rather than between neighbouring directions keeps the phase
+     correct with a much smaller table. With no memory for the table, FIRs are designed from scratch.
+     The table is shared with other beamformers and only read.
+
+     Parameters and FIRs are handed over between the audio thread and the background thread through a SlotExchange
+     each: no locks, no copies, older values are simply skipped.
+     The background thread polls for new parameters, the audio thread doesn't wake it.
+     */
+    class FirDesigner : public Thread {
+    public:
+        /** Initialize the designer
 
-    /** FIR filters for each beam */
-    std::vector<AudioBuffer<float>> firIR;
-    std::vector<AudioBufferFFT> firFFT;
+         @param steeringTable: FIRs to interpolate, none to design each FIR from scratch
+         */
+        FirDesigner(const BeamformingAlgorithm &alg, const UniformPartitionedConvolution &engine, int numSources,
+                    int numMic, int firLen, std::shared_ptr<const SteeringTable> steeringTable);
 
-    /** Inputs' buffer */
-    AudioBufferFFT inputBuffer;
+        ~FirDesigner();
 
-    /** Convolution buffer */
-    AudioBufferFFT convolutionBuffer;
+        void run() override;
 
-    /** Outputs buffer */
-    AudioBuffer<float> outBuffer;
+        /** Ask for the FIRs of a source to be designed for new parameters. Audio thread */
+        void requestFir(int srcIdx, const BeamParameters &params);
 
-    /** FIR coefficients update time constant [s] */
+        /** Take the most recent FIRs of a source, if any were published since the last call. Audio thread
+
+         The FIRs taken before stay valid until releaseOldFir is called.
+         @param params: destination for the parameters the FIRs were designed for
+         @return the FIRs, nullptr if nothing new was published
+         */
+        const UniformPartitionedConvolution::ImpulseResponse *takeNewFir(int srcIdx, BeamParameters &params);
+
+        /** Give back the FIRs in use before the last takeNewFir. Audio thread */
+        void releaseOldFir(int srcIdx);
+
+        /** Get the FIRs taken with the last takeNewFir. Audio thread */
+        const UniformPartitionedConvolution::ImpulseResponse &getFir(int srcIdx) const;
+
+        /** Record the design time of each FIR. Any thread */
+        void setProfiler(Profiler *profiler);
+
+    private:
+
+        struct Source {
+            /** Requested parameters, three slots */
+            BeamParameters params[3];
+            SlotExchange paramsExchange{2};
+            /** Owned by the audio thread */
+            int paramsWriteSlot = 0;
+            /** Owned by the background thread */
+            int paramsReadSlot = 1;
+
+            /** FIRs and the parameters they were designed for, four slots */
+            std::unique_ptr<UniformPartitionedConvolution::ImpulseResponse> firs[4];
+            BeamParameters firParams[4];
+            SlotExchange firExchange{3};
+            /** Owned by the background thread */
+            int firDesignSlot = 0;
+            /** Owned by the audio thread. FIRs in use, and FIRs fading in or free */
+            int firCurrentSlot = 1;
+            int firSpareSlot = 2;
+        };
+
+        const BeamformingAlgorithm &alg;
+
+        std::vector<std::unique_ptr<Source>> sources;
+
+        /** Number of microphones */
+        int numMic;
+
+        /** FIRs in time domain */
+        AudioBuffer<float> fir;
+
+        /** Time between polls for new parameters [ms] */
+        const int pollInterval = 1;
+
+        /** Steering table */
+        std::shared_ptr<const SteeringTable> steeringTable;
+
+        /** Delays [samples] and gains of the microphones for the FIRs being designed */
+        Vec micDelays;
+        Vec micGains;
+
+        /** Design timings destination, if any */
+        std::atomic<Profiler *> profiler{nullptr};
+
+        /** Design the FIRs for a set of parameters */
+        void design(UniformPartitionedConvolution::ImpulseResponse &dest, const BeamParameters &params);
+
+    };
+
+    /** Stages timings destination, if any */
+    Profiler *profiler = nullptr;
+
+    /** Timeline of the blocks and of the parameters changes. nullptr if not profiling */
+    TraceRecorder *trace = nullptr;
+
+    /** Worker threads for the convolution engines, if any. Declared first so that it outlives them */
+    std::unique_ptr<WorkerPool> workerPool;
+
+    /** FIR designer. Declared before the convolution engine, that uses its FIRs */
+    std::unique_ptr<FirDesigner> firDesigner;
+
+    /** Convolution engine. One input per source, one output per microphone */
+    std::unique_ptr<UniformPartitionedConvolution> convolution;
+
+    /** Sources rendered through impulse responses */
+    std::vector<bool> useImpulseResponse;
+
+    /** Impulse responses for each source */
+    std::vector<AudioBuffer<float>> impulseResponses;
+
+    /** Convolution engine for the impulse responses. One input per source, one output per microphone */
+    std::unique_ptr<NonUniformPartitionedConvolution> irConvolution;
+
+    /** Rendering mode */
+    RenderingMode renderingMode = CONVOLUTION;
+
+    /** Fractional delay renderer. One input per source, one output per microphone */
+    std::unique_ptr<FractionalDelayRenderer> fractionalDelay;
+
+    /** Variable delay renderer. One input per source, one output per microphone */
+    std::unique_ptr<VariableDelayRenderer> variableDelay;
+
+    /** Smoothed delays [samples] and gains for each source, used by the fractional delay renderer */
+    std::vector<Vec> micDelays;
+    std::vector<Vec> micGains;
+
+    /** Target delays [samples] and gains */
+    Vec targetMicDelays;
+    Vec targetMicGains;
+
+    /** Whether the delays or the FIRs of each source must jump to the target, with no smoothing */
+    std::vector<bool> snapParams;
+
+    /** Whether the parameters of the sources are frozen */
+    bool paramsFrozen = false;
+
+    /** Parameters of each source when frozen */
+    std::vector<BeamParameters> frozenParams;
+
+    /** Whether each source is rendered as its last applied parameters ask, with nothing left to smooth or take */
+    std::vector<bool> paramsSettled;
+
+    /** Whether each source is active. Inactive sources are silent */
+    std::vector<bool> sourceActive;
+
+    /** Latest parameters for each source, and whether they have been set */
+    std::vector<BeamParameters> beamParams;
+    std::vector<bool> hasBeamParams;
+
+    /** Sources FIFO, one internal block */
+    AudioBuffer<float> inputFifo;
+
+    /** Microphones FIFO, one internal block rendered from the previous inputFifo */
+    AudioBuffer<float> outputFifo;
+
+    /** Position of the next sample in both FIFOs */
+    int fifoPos = 0;
+    
+    /** Samples processed since construction, up to the ones needed to settle */
+    int numSettlingSamples = 0;
+
+    /** Delays and gains update time constant, fractional delay mode [s] */
     const float firUpdateTimeConst = 0.2;
-    /** FIR coefficients update alpha */
+    /** Delays and gains update alpha */
     float alpha = 1;
+    
+    /** Default crossfade time between FIRs [s] */
+    const float firCrossfadeTime = 0.05;
+    
+    /** Crossfade time between FIRs [s] */
+    float crossfadeTime = firCrossfadeTime;
+    
+    /** Parameters requested to the FIR designer for each source */
+    std::vector<BeamParameters> requestedParams;
+    
+    /** Parameters the FIRs in use for each source were designed for */
+    std::vector<BeamParameters> firParams;
+    
+    /** Whether the FIRs of each source are fading in */
+    std::vector<bool> firPending;
 
     /** Microphones configuration */
     MicConfig micConfig = ULA_1ESTICK;
 
-    /** Initialize the beamforming algorithm */
-    void initAlg();
+    /** Time the convolution engine with all the candidate block sizes, return the cheapest per sample
+     
+     With workers, each candidate gets a block per period as in playback, so that it gets the speedup the workers
+     give at that period rather than the one of back to back blocks.
+     */
+    int selectBlockSize() const;
+    
+    /** Update the renderer of a source with new parameters */
+    void applyParams(int srcIdx, const BeamParameters &params);
+    
+    /** Apply the latest parameters and render inputFifo into outputFifo */
+    void processInternalBlock();
 
 
 };
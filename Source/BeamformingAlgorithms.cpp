@@ -23,20 +23,18 @@ namespace DAS {
         commonDelay = 64;
         firLen = ceil(jmax(numMic/numRows * micDistX,numRows * micDistY) / soundspeed * fs) + 2 * commonDelay;
 
-        fft = std::make_unique<juce::dsp::FFT>(ceil(log2(firLen)));
+        fft = FFTBackend::create(ceil(log2(firLen)));
 
         win.resize(fft->getSize());
         designTukeyWindow(win, fft->getSize(), commonDelay / 2);
 
-        freqAxes = Vec::LinSpaced(fft->getSize(), 0, fs * (fft->getSize() - 1) / fft->getSize());
-
     }
 
     int FarfieldURA::getFirLen() const {
         return firLen;
     }
 
-    void FarfieldURA::getFir(AudioBuffer<float> &fir, const BeamParameters &params, float alpha) const {
+    void FarfieldURA::getSeparableDelays(Vec &colDelays, Vec &rowDelays, const BeamParameters &params) const {
 
         /** Angle in radians (0 front, pi/2 source closer to last channel, -pi/2 source closer to first channel */
         const float angleRadX = params.doaX * pi / 2;
@@ -47,45 +45,79 @@ namespace DAS {
         /** Delay between adjacent microphones [s] */
         const float deltaY = sin(angleRadY) * micDistY / soundspeed;
         /** Compute delays for each microphone, X component [s] */
-        const Vec micDelaysX = deltaX * Vec::LinSpaced(numMicPerRow, 0, numMicPerRow - 1);
+        Vec micDelaysX = deltaX * Vec::LinSpaced(numMicPerRow, 0, numMicPerRow - 1);
         /** Compute delays for each microphone, Y component [s] */
-        const Vec micDelaysY = deltaY * Vec::LinSpaced(numRows, 0, numRows - 1);
-        /** Matrix of delays. Eigen is column-first.*/
-        Mtx micDelaysMtx = micDelaysX.replicate(1,numRows) + micDelaysY.transpose().replicate(numMicPerRow,1);
-        /** Vector of delays */
-        Eigen::Map<Vec> micDelays(micDelaysMtx.data(),micDelaysMtx.size());
-        /** Compensate for minimum delay and apply common delay */
-        micDelays.array() += -micDelays.minCoeff() + commonDelay / fs;
-        /** Compute the fractional delays in frequency domain */
-        CpxMtx irFFT = (-j2pi * freqAxes * micDelays.transpose()).array().exp();
+        Vec micDelaysY = deltaY * Vec::LinSpaced(numRows, 0, numRows - 1);
+        /** Compensate for minimum delay, the minimum of the sum is the sum of the minima. Apply common delay */
+        micDelaysX.array() += -micDelaysX.minCoeff() + commonDelay / fs;
+        micDelaysY.array() -= micDelaysY.minCoeff();
+        /** Convert to samples */
+        colDelays = micDelaysX * fs;
+        rowDelays = micDelaysY * fs;
+
+    }
+
+    void FarfieldURA::getDelaysAndGains(Vec &delays, Vec &gains, const BeamParameters &params) const {
 
+        /** Called by the audio thread: delays and gains are written in place, without any temporary. Resizing is a
+         no-op once the destinations hold one element per microphone */
+        delays.resize(numMic);
+        gains.resize(numMic);
+
+        /** Delay between adjacent microphones [s], as in getSeparableDelays */
+        const float deltaX = sin(params.doaX * pi / 2) * micDistX / soundspeed;
+        const float deltaY = sin(params.doaY * pi / 2) * micDistY / soundspeed;
+        /** Minimum delay of each axis, the minimum of the sum is the sum of the minima [s] */
+        const float minDelayX = jmin(0.f, deltaX * (numMicPerRow - 1));
+        const float minDelayY = jmin(0.f, deltaY * (numRows - 1));
 
         /** Compute how many microphones are muted at each end */
         const int inactiveMicAtBorderX = roundToInt((numMicPerRow / 2 - 1) * params.width);
         const int inactiveMicAtBorderY = roundToInt((numRows / 2 - 1) * params.width);
-        /** Generate the mask of active microphones.  Eigen is column-first.*/
-        Mtx micGainsMtx = Mtx::Ones(numMicPerRow,numRows);
-        for (auto colIdx = 0; colIdx < numRows; colIdx++){
-            if ((colIdx < inactiveMicAtBorderY) || (colIdx>=numRows-inactiveMicAtBorderY)){
-                micGainsMtx.col(colIdx).setZero();
-            }else{
-                micGainsMtx.col(colIdx).head(inactiveMicAtBorderX).array() = 0;
-                micGainsMtx.col(colIdx).tail(inactiveMicAtBorderX).array() = 0;
+
+        int numActiveMic = 0;
+        for (auto rowIdx = 0; rowIdx < numRows; rowIdx++) {
+            const bool activeRow = rowIdx >= inactiveMicAtBorderY && rowIdx < numRows - inactiveMicAtBorderY;
+            for (auto colIdx = 0; colIdx < numMicPerRow; colIdx++) {
+                const int micIdx = rowIdx * numMicPerRow + colIdx;
+                /** Compensate for the minimum delay, apply the common delay and convert to samples */
+                delays(micIdx) = (deltaX * colIdx - minDelayX + deltaY * rowIdx - minDelayY) * fs + commonDelay;
+                const bool active = activeRow && colIdx >= inactiveMicAtBorderX &&
+                                    colIdx < numMicPerRow - inactiveMicAtBorderX;
+                gains(micIdx) = active ? 1 : 0;
+                numActiveMic += active;
             }
         }
-        
-        Eigen::Map<Vec> micGains(micGainsMtx.data(),micGainsMtx.size());
-        
+
         /** Normalize the power */
-        micGains.array() *= referencePower / micGains.sum();
+        gains *= referencePower / numActiveMic;
 
-        /** Apply the gain */
-        irFFT = irFFT.cwiseProduct(micGains.transpose().replicate(freqAxes.size(), 1));
+    }
 
-        /** Convert  from requency to time domain and add to destination*/
-        for (auto micIdx = 0; micIdx < jmin(numMic, fir.getNumChannels()); micIdx++) {
-            freqToTime(fir, micIdx, irFFT.col(micIdx), fft.get(), win, alpha);
+    void FarfieldURA::getFir(AudioBuffer<float> &fir, const BeamParameters &params, float alpha) const {
+
+        /** Delays [samples] and gains for each microphone */
+        Vec micDelays, micGains;
+        getDelaysAndGains(micDelays, micGains, params);
+
+        /** Compute the fractional delays in frequency domain. Each microphone is delayed by the sum of a column
+         delay and a row delay, so its spectrum is the product of the spectra of the two */
+        Vec colDelays, rowDelays;
+        getSeparableDelays(colDelays, rowDelays, params);
+        CpxMtx colFFT, rowFFT;
+        delaysToFreq(colFFT, colDelays, fft->getSize(), fft->getNumBins());
+        delaysToFreq(rowFFT, rowDelays, fft->getSize(), fft->getNumBins());
+        CpxMtx irFFT(fft->getNumBins(), numMic);
+        for (auto rowIdx = 0; rowIdx < numRows; rowIdx++) {
+            for (auto colIdx = 0; colIdx < numMicPerRow; colIdx++) {
+                const int micIdx = rowIdx * numMicPerRow + colIdx;
+                /** Apply the gain */
+                irFFT.col(micIdx) = micGains(micIdx) * colFFT.col(colIdx).cwiseProduct(rowFFT.col(rowIdx));
+            }
         }
+
+        /** Convert  from requency to time domain and add to destination*/
+        freqToTime(fir, irFFT, fft.get(), win, alpha);
         /** Clear the remaining FIR, if any */
         for (auto micIdx = jmin(numMic, fir.getNumChannels()); micIdx < fir.getNumChannels(); micIdx++) {
             fir.clear(micIdx, 0, fir.getNumSamples());
@@ -93,5 +125,19 @@ namespace DAS {
 
     }
 
+    Range<float> FarfieldURA::getDelayRange() const {
+        /** From commonDelay, closest microphone, to the farthest microphone at the widest angle */
+        const float maxRelativeDelay = ((numMicPerRow - 1) * micDistX + (numRows - 1) * micDistY) / soundspeed * fs;
+        return {float(commonDelay), commonDelay + maxRelativeDelay};
+    }
+
+    void FarfieldURA::getDelayFirs(AudioBuffer<float> &firs, const Vec &delays) const {
+        jassert(firs.getNumChannels() >= delays.size());
+
+        /** Same design as getFir, a single microphone with unit gain per delay */
+        CpxMtx irFFT;
+        delaysToFreq(irFFT, delays, fft->getSize(), fft->getNumBins());
+        freqToTime(firs, irFFT, fft.get(), win);
+    }
 
 }
@@ -33,6 +33,14 @@ typedef struct {
     float width;
 } BeamParameters;
 
+inline bool operator==(const BeamParameters &a, const BeamParameters &b) {
+    return a.doaX == b.doaX && a.doaY == b.doaY && a.width == b.width;
+}
+
+inline bool operator!=(const BeamParameters &a, const BeamParameters &b) {
+    return !(a == b);
+}
+
 
 /** Virtual class extended by all beamforming algorithms */
 class BeamformingAlgorithm {
@@ -52,6 +60,24 @@ public:
      */
     virtual void getFir(AudioBuffer<float> &fir, const BeamParameters &params, float alpha = 1) const = 0;
 
+    /** Get the delay and the gain of each microphone for a given direction of arrival
+
+     @param delays: destination for the delays, including the common delay [samples]. One element per microphone
+     @param gains: destination for the gains. One element per microphone
+     @param params: beam parameters
+     */
+    virtual void getDelaysAndGains(Vec &delays, Vec &gains, const BeamParameters &params) const = 0;
+
+    /** Get the range of the delays returned by getDelaysAndGains [samples] */
+    virtual Range<float> getDelayRange() const = 0;
+
+    /** Get the unit gain FIR of a microphone for each of the given delays, as designed by getFir
+
+     @param firs: an AudioBuffer object with numChannels >= number of delays and numSamples >= firLen
+     @param delays: delays [samples]
+     */
+    virtual void getDelayFirs(AudioBuffer<float> &firs, const Vec &delays) const = 0;
+
 };
 
 /** Delay-And-Sum Beamformers*/
@@ -87,8 +113,35 @@ namespace DAS {
          */
         void getFir(AudioBuffer<float> &fir, const BeamParameters &params, float alpha = 1) const override;
 
+        /** Get the delay and the gain of each microphone for a given direction of arrival
+
+         @param delays: destination for the delays, including the common delay [samples]. One element per microphone
+         @param gains: destination for the gains. One element per microphone
+         @param params: beam parameters
+         */
+        void getDelaysAndGains(Vec &delays, Vec &gains, const BeamParameters &params) const override;
+
+        /** Get the range of the delays returned by getDelaysAndGains [samples] */
+        Range<float> getDelayRange() const override;
+
+        /** Get the unit gain FIR of a microphone for each of the given delays, as designed by getFir
+
+         @param firs: an AudioBuffer object with numChannels >= number of delays and numSamples >= firLen
+         @param delays: delays [samples]
+         */
+        void getDelayFirs(AudioBuffer<float> &firs, const Vec &delays) const override;
+
     private:
 
+        /** Get the delays of the microphones of a row and of the rows, so that the delay of each microphone is the
+         sum of its column delay and its row delay
+
+         @param colDelays: destination for the delays of the microphones within a row, including the common
+                           delay [samples]
+         @param rowDelays: destination for the delays of the rows [samples]
+         */
+        void getSeparableDelays(Vec &colDelays, Vec &rowDelays, const BeamParameters &params) const;
+
         /** Distance between microphones, X axes [m] */
         float micDistX;
         
@@ -117,14 +170,11 @@ namespace DAS {
         int firLen;
 
         /** FFT object */
-        std::unique_ptr<juce::dsp::FFT> fft;
+        std::shared_ptr<FFTBackend> fft;
 
         /** Window applied to the FIR filters in time domain */
         Vec win;
 
-        /** Frequencies axes */
-        Vec freqAxes;
-
         /** Reference power for normalization */
         const float referencePower = 3;
 
@@ -0,0 +1,117 @@
+/*
+ SIMD complex multiply-accumulate kernels
+
+ Authors:
+ Luca Bondi (luca.bondi@polimi.it)
+*/
+
+#include "ComplexMAC.h"
+
+#if JUCE_INTEL
+ #include <immintrin.h>
+ #if JUCE_GCC || JUCE_CLANG
+  /** Kernels for extended instruction sets are compiled regardless of the target architecture of the project */
+  #define COMPLEX_MAC_TARGET(isa) __attribute__((target(isa)))
+ #else
+  #define COMPLEX_MAC_TARGET(isa)
+ #endif
+#endif
+
+namespace ComplexMAC {
+
+    typedef void (*Kernel)(float *, float *, const float *, const float *, const float *, const float *, int);
+
+    static void multiplyAccumulateScalar(float *outRe, float *outIm, const float *aRe, const float *aIm,
+                                         const float *bRe, const float *bIm, int numElements) {
+        for (auto idx = 0; idx < numElements; idx++) {
+            outRe[idx] += aRe[idx] * bRe[idx] - aIm[idx] * bIm[idx];
+            outIm[idx] += aRe[idx] * bIm[idx] + aIm[idx] * bRe[idx];
+        }
+    }
+
+#if JUCE_INTEL
+
+    COMPLEX_MAC_TARGET("sse2")
+    static void multiplyAccumulateSSE(float *outRe, float *outIm, const float *aRe, const float *aIm,
+                                      const float *bRe, const float *bIm, int numElements) {
+        for (auto idx = 0; idx < numElements; idx += 4) {
+            const __m128 ar = _mm_load_ps(aRe + idx);
+            const __m128 ai = _mm_load_ps(aIm + idx);
+            const __m128 br = _mm_load_ps(bRe + idx);
+            const __m128 bi = _mm_load_ps(bIm + idx);
+            const __m128 re = _mm_sub_ps(_mm_mul_ps(ar, br), _mm_mul_ps(ai, bi));
+            const __m128 im = _mm_add_ps(_mm_mul_ps(ar, bi), _mm_mul_ps(ai, br));
+            _mm_store_ps(outRe + idx, _mm_add_ps(_mm_load_ps(outRe + idx), re));
+            _mm_store_ps(outIm + idx, _mm_add_ps(_mm_load_ps(outIm + idx), im));
+        }
+    }
+
+    COMPLEX_MAC_TARGET("avx2,fma")
+    static void multiplyAccumulateAVX2(float *outRe, float *outIm, const float *aRe, const float *aIm,
+                                       const float *bRe, const float *bIm, int numElements) {
+        for (auto idx = 0; idx < numElements; idx += 8) {
+            const __m256 ar = _mm256_load_ps(aRe + idx);
+            const __m256 ai = _mm256_load_ps(aIm + idx);
+            const __m256 br = _mm256_load_ps(bRe + idx);
+            const __m256 bi = _mm256_load_ps(bIm + idx);
+            __m256 re = _mm256_load_ps(outRe + idx);
+            __m256 im = _mm256_load_ps(outIm + idx);
+            re = _mm256_fnmadd_ps(ai, bi, _mm256_fmadd_ps(ar, br, re));
+            im = _mm256_fmadd_ps(ai, br, _mm256_fmadd_ps(ar, bi, im));
+            _mm256_store_ps(outRe + idx, re);
+            _mm256_store_ps(outIm + idx, im);
+        }
+    }
+
+    COMPLEX_MAC_TARGET("avx512f")
+    static void multiplyAccumulateAVX512(float *outRe, float *outIm, const float *aRe, const float *aIm,
+                                         const float *bRe, const float *bIm, int numElements) {
+        for (auto idx = 0; idx < numElements; idx += 16) {
+            const __m512 ar = _mm512_load_ps(aRe + idx);
+            const __m512 ai = _mm512_load_ps(aIm + idx);
+            const __m512 br = _mm512_load_ps(bRe + idx);
+            const __m512 bi = _mm512_load_ps(bIm + idx);
+            __m512 re = _mm512_load_ps(outRe + idx);
+            __m512 im = _mm512_load_ps(outIm + idx);
+            re = _mm512_fnmadd_ps(ai, bi, _mm512_fmadd_ps(ar, br, re));
+            im = _mm512_fmadd_ps(ai, br, _mm512_fmadd_ps(ar, bi, im));
+            _mm512_store_ps(outRe + idx, re);
+            _mm512_store_ps(outIm + idx, im);
+        }
+    }
+
+#endif
+
+    struct Dispatch {
+        Kernel kernel;
+        const char *name;
+    };
+
+    static Dispatch selectKernel() {
+#if JUCE_INTEL
+        if (SystemStats::hasAVX512F())
+            return {multiplyAccumulateAVX512, "AVX-512"};
+        if (SystemStats::hasAVX2() && SystemStats::hasFMA3())
+            return {multiplyAccumulateAVX2, "AVX2"};
+        if (SystemStats::hasSSE2())
+            return {multiplyAccumulateSSE, "SSE"};
+#endif
+        return {multiplyAccumulateScalar, "Scalar"};
+    }
+
+    /** CPU features are checked once, when the plugin is loaded */
+    static const Dispatch dispatch = selectKernel();
+
+    void multiplyAccumulate(float *outRe, float *outIm, const float *aRe, const float *aIm, const float *bRe,
+                            const float *bIm, int numElements) {
+        jassert(numElements % granularity == 0);
+        jassert(((size_t) outRe | (size_t) outIm | (size_t) aRe | (size_t) aIm | (size_t) bRe | (size_t) bIm)
+                % alignment == 0);
+        dispatch.kernel(outRe, outIm, aRe, aIm, bRe, bIm, numElements);
+    }
+
+    String getKernelName() {
+        return dispatch.name;
+    }
+
+}
@@ -0,0 +1,37 @@
+/*
+ SIMD complex multiply-accumulate kernels
+
+ Authors:
+ Luca Bondi (luca.bondi@polimi.it)
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+/** Complex multiply-accumulate on spectra stored as split real and imaginary arrays
+
+ The fastest kernel supported by the CPU (AVX-512, AVX2 with FMA, SSE or plain C++) is selected at runtime.
+ */
+namespace ComplexMAC {
+
+    /** Required alignment of the arrays [bytes] */
+    const int alignment = 64;
+
+    /** The number of elements must be a multiple of granularity, i.e. one AVX-512 register */
+    const int granularity = 16;
+
+    /** Element-wise complex multiply-accumulate, out += a * b
+
+     @param outRe, outIm: real and imaginary parts of the accumulator
+     @param aRe, aIm: real and imaginary parts of the first operand
+     @param bRe, bIm: real and imaginary parts of the second operand
+     @param numElements: number of complex elements. Must be a multiple of granularity
+     */
+    void multiplyAccumulate(float *outRe, float *outIm, const float *aRe, const float *aIm, const float *bRe,
+                            const float *bIm, int numElements);
+
+    /** Get the name of the kernel in use */
+    String getKernelName();
+
+}
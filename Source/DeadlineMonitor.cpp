@@ -0,0 +1,138 @@
+/*
+ Audio callback deadline monitor
+
+ Authors:
+ Luca Bondi (luca.bondi@polimi.it)
+*/
+
+#include "DeadlineMonitor.h"
+
+DeadlineMonitor::DeadlineMonitor() : deadlineFraction(1), numCallbacks(0), numMisses(0), maxLoad(0),
+                                     snapshotExchange(2) {
+    originTicks = Time::getHighResolutionTicks();
+    secondsPerTick = 1. / Time::getHighResolutionTicksPerSecond();
+    for (auto &bucket : buckets) {
+        bucket.second = -1;
+        bucket.numCallbacks = 0;
+        bucket.numMisses = 0;
+    }
+}
+
+void DeadlineMonitor::setDeadlineFraction(float fraction) {
+    jassert(fraction > 0);
+    deadlineFraction = fraction;
+}
+
+DeadlineMonitor::Outcome DeadlineMonitor::recordCallback(int64 startTicks, int64 endTicks, int numSamples,
+                                                          double sampleRate) {
+    const double duration = (endTicks - startTicks) * secondsPerTick;
+    const double period = numSamples / sampleRate;
+    const double load = duration / period;
+    const bool late = load > deadlineFraction.load(std::memory_order_relaxed);
+
+    numCallbacks.fetch_add(1, std::memory_order_relaxed);
+    if (load > maxLoad.load(std::memory_order_relaxed)) {
+        maxLoad.store(load, std::memory_order_relaxed);
+    }
+
+    /** Start afresh the bucket of the current second if it was last used a minute ago */
+    const int64 second = (endTicks - originTicks) * secondsPerTick;
+    auto &bucket = buckets[second % windowLength];
+    if (bucket.second.load(std::memory_order_relaxed) != second) {
+        bucket.numCallbacks.store(0, std::memory_order_relaxed);
+        bucket.numMisses.store(0, std::memory_order_relaxed);
+        bucket.second.store(second, std::memory_order_release);
+    }
+    bucket.numCallbacks.fetch_add(1, std::memory_order_relaxed);
+
+    if (!late) {
+        return onTime;
+    }
+
+    numMisses.fetch_add(1, std::memory_order_relaxed);
+    bucket.numMisses.fetch_add(1, std::memory_order_relaxed);
+
+    if (numWorst == numWorstMisses &&
+        load <= worstMisses[numWorst - 1].duration / worstMisses[numWorst - 1].period) {
+        return missed;
+    }
+    candidate.time = (endTicks - originTicks) * secondsPerTick;
+    candidate.duration = duration;
+    candidate.period = period;
+    candidate.numSamples = numSamples;
+    return worstMiss;
+}
+
+void DeadlineMonitor::recordScene(const Scene &scene) {
+    candidate.scene = scene;
+
+    /** Insertion in the sorted list, the least bad miss drops out when full */
+    const double load = candidate.duration / candidate.period;
+    int idx = jmin(numWorst, numWorstMisses - 1);
+    while (idx > 0 && worstMisses[idx - 1].duration / worstMisses[idx - 1].period < load) {
+        worstMisses[idx] = worstMisses[idx - 1];
+        idx--;
+    }
+    worstMisses[idx] = candidate;
+    numWorst = jmin(numWorst + 1, numWorstMisses);
+
+    /** Publish a copy for the readers */
+    auto &snapshot = snapshots[writeSnapshot];
+    std::copy(worstMisses, worstMisses + numWorst, snapshot.misses);
+    snapshot.numMisses = numWorst;
+    snapshotExchange.publish(writeSnapshot);
+}
+
+DeadlineMonitor::Statistics DeadlineMonitor::getStatistics() const {
+    Statistics stats;
+    stats.numCallbacks = numCallbacks.load(std::memory_order_relaxed);
+    stats.numMisses = numMisses.load(std::memory_order_relaxed);
+    stats.maxLoad = maxLoad.load(std::memory_order_relaxed);
+
+    /** Buckets being reset are counted within a few callbacks */
+    const int64 now = (Time::getHighResolutionTicks() - originTicks) * secondsPerTick;
+    stats.numCallbacksLastMinute = 0;
+    stats.numMissesLastMinute = 0;
+    for (const auto &bucket : buckets) {
+        if (bucket.second.load(std::memory_order_acquire) > now - windowLength) {
+            stats.numCallbacksLastMinute += bucket.numCallbacks.load(std::memory_order_relaxed);
+            stats.numMissesLastMinute += bucket.numMisses.load(std::memory_order_relaxed);
+        }
+    }
+    return stats;
+}
+
+std::vector<DeadlineMonitor::Miss> DeadlineMonitor::getWorstMisses() {
+    const ScopedLock lock(readLock);
+    snapshotExchange.acquire(readSnapshot);
+    const auto &snapshot = snapshots[readSnapshot];
+    return std::vector<Miss>(snapshot.misses, snapshot.misses + snapshot.numMisses);
+}
+
+String DeadlineMonitor::getReport() {
+    const auto stats = getStatistics();
+    String report;
+    report << "Deadline " << String(getDeadlineFraction() * 100, 0) << "% of the callback period" << newLine;
+    report << "Missed " << String(stats.numMisses) << " of " << String(stats.numCallbacks) << " callbacks, "
+           << String(stats.numMissesLastMinute) << " of " << String(stats.numCallbacksLastMinute)
+           << " in the last minute. Worst load " << String(stats.maxLoad * 100, 1) << "%" << newLine;
+    for (const auto &miss : getWorstMisses()) {
+        const auto &scene = miss.scene;
+        report << "  at " << String(miss.time, 3) << " s: " << String(miss.duration * 1e3, 3) << " ms for "
+               << String(miss.numSamples) << " samples (" << String(miss.duration / miss.period * 100, 1) << "%), "
+               << micConfigLabels[scene.config] << ", " << renderingModeLabels[scene.renderingMode]
+               << ", HPF " << String(scene.hpfFreq, 0) << " Hz" << (scene.switchingConfig ? ", switching" : "");
+        for (auto srcIdx = 0; srcIdx < NUM_SOURCES; srcIdx++) {
+            report << ", source " << String(srcIdx + 1) << " ";
+            if (scene.muted[srcIdx] || !scene.active[srcIdx]) {
+                report << (scene.muted[srcIdx] ? "muted" : "gated");
+            } else {
+                const auto &beam = scene.beams[srcIdx];
+                report << "(" << String(beam.doaX, 2) << ", " << String(beam.doaY, 2) << ") width "
+                       << String(beam.width, 2) << " level " << String(scene.levels[srcIdx], 1) << " dB";
+            }
+        }
+        report << newLine;
+    }
+    return report;
+}
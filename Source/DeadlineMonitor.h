@@ -0,0 +1,152 @@
+/*
+ Audio callback deadline monitor
+
+ Authors:
+ Luca Bondi (luca.bondi@polimi.it)
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "eStickSimDefs.h"
+#include "BeamformingAlgorithms.h"
+#include "SlotExchange.h"
+
+/** Counts the callbacks that miss their deadline, and keeps the worst ones with the scene they were processing
+
+ The deadline of a callback is a fraction of its own period, i.e. of the duration of the samples it was given.
+ Counts are kept since construction and over the last minute, with one-second resolution. The worst misses are
+ ranked by their duration relative to the period.
+
+ The audio thread records without locks or allocations. Statistics and worst misses can be read from any other
+ thread while recording goes on.
+ */
+class DeadlineMonitor {
+
+public:
+
+    /** Processing settings at the time of a callback */
+    struct Scene {
+        MicConfig config;
+        RenderingMode renderingMode;
+        /** High-pass filter cut frequency [Hz] */
+        float hpfFreq;
+        /** True while crossfading to a new microphone configuration */
+        bool switchingConfig;
+        /** Steering and width of the sources, as set by the host */
+        BeamParameters beams[NUM_SOURCES];
+        /** Source levels [dB] */
+        float levels[NUM_SOURCES];
+        bool muted[NUM_SOURCES];
+        /** False for sources gated for silence */
+        bool active[NUM_SOURCES];
+    };
+
+    /** A callback that missed the deadline */
+    struct Miss {
+        /** Time since construction [s] */
+        double time;
+        /** Processing time [s] */
+        double duration;
+        /** Callback period [s] */
+        double period;
+        int numSamples;
+        Scene scene;
+    };
+
+    /** Outcome of a callback */
+    enum Outcome {
+        onTime,
+        missed,
+        /** Missed, and among the worst misses so far */
+        worstMiss
+    };
+
+    /** Callback counts [callbacks] and worst processing time relative to the period */
+    struct Statistics {
+        int64 numCallbacks;
+        int64 numMisses;
+        int64 numCallbacksLastMinute;
+        int64 numMissesLastMinute;
+        double maxLoad;
+    };
+
+    DeadlineMonitor();
+
+    /** Set the deadline as a fraction of the callback period. Any thread
+
+     1 counts only the callbacks that took longer than their period, lower values check for headroom.
+     */
+    void setDeadlineFraction(float fraction);
+
+    /** Get the deadline as a fraction of the callback period. Any thread */
+    float getDeadlineFraction() const { return deadlineFraction; }
+
+    /** Record a callback. Audio thread
+
+     @param startTicks: start of the processing [high resolution ticks]
+     @param endTicks: end of the processing [high resolution ticks]
+     @return worstMiss if the callback ranks among the worst misses, then recordScene must follow
+     */
+    Outcome recordCallback(int64 startTicks, int64 endTicks, int numSamples, double sampleRate);
+
+    /** Keep the callback just recorded among the worst misses, with its scene. Audio thread */
+    void recordScene(const Scene &scene);
+
+    /** Get the callback counts. Any thread */
+    Statistics getStatistics() const;
+
+    /** Get the worst misses since construction, the worst first. Any thread but the audio thread */
+    std::vector<Miss> getWorstMisses();
+
+    /** Get a summary of the statistics and of the worst misses */
+    String getReport();
+
+private:
+
+    /** Number of worst misses kept */
+    static const int numWorstMisses = 8;
+    /** Length of the rolling window [s] */
+    static const int windowLength = 60;
+
+    std::atomic<float> deadlineFraction;
+
+    int64 originTicks;
+    double secondsPerTick;
+
+    std::atomic<int64> numCallbacks;
+    std::atomic<int64> numMisses;
+    std::atomic<double> maxLoad;
+
+    /** Counts of one second of the rolling window. Reset by the audio thread when the second is reused */
+    struct Bucket {
+        std::atomic<int64> second;
+        std::atomic<int64> numCallbacks;
+        std::atomic<int64> numMisses;
+    };
+
+    Bucket buckets[windowLength];
+
+    /** Worst misses, sorted. Audio thread only */
+    Miss worstMisses[numWorstMisses];
+    int numWorst = 0;
+
+    /** Callback just recorded, waiting for its scene. Audio thread only */
+    Miss candidate;
+
+    /** Copies of the worst misses, handed over to the readers */
+    struct Snapshot {
+        Miss misses[numWorstMisses];
+        int numMisses = 0;
+    };
+
+    Snapshot snapshots[3];
+    SlotExchange snapshotExchange;
+    /** Owned by the audio thread */
+    int writeSnapshot = 0;
+    /** Owned by the readers, guarded by readLock */
+    int readSnapshot = 1;
+    CriticalSection readLock;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (DeadlineMonitor)
+};
@@ -0,0 +1,226 @@
+/*
+ FFT backends
+
+ Authors:
+ Luca Bondi (luca.bondi@polimi.it)
+*/
+
+#include "FFTBackend.h"
+
+// ==============================================================================
+std::shared_ptr<FFTBackend> FFTBackend::create(int order, FFTBackendType type) {
+    switch (type) {
+        case FFT_BACKEND_JUCE:
+            return std::make_shared<JuceFFTBackend>(order);
+        case FFT_BACKEND_STOCKHAM:
+            return std::make_shared<StockhamFFTBackend>(order);
+    }
+    jassertfalse;
+    return nullptr;
+}
+
+// ==============================================================================
+JuceFFTBackend::JuceFFTBackend(int order) : FFTBackend(order), fft(order) {
+}
+
+void JuceFFTBackend::performRealForward(const float *const *in, int numSamples, float *const *outRe,
+                                        float *const *outIm, int numChannels, float *scratch) const {
+    jassert(numSamples <= size);
+
+    for (auto channelIdx = 0; channelIdx < numChannels; channelIdx++) {
+        FloatVectorOperations::copy(scratch, in[channelIdx], numSamples);
+        FloatVectorOperations::clear(scratch + numSamples, size - numSamples);
+        fft.performRealOnlyForwardTransform(scratch);
+
+        /** Interleaved to split complex */
+        auto re = outRe[channelIdx];
+        auto im = outIm[channelIdx];
+        for (auto binIdx = 0; binIdx < getNumBins(); binIdx++) {
+            re[binIdx] = scratch[2 * binIdx];
+            im[binIdx] = scratch[2 * binIdx + 1];
+        }
+    }
+}
+
+void JuceFFTBackend::performRealInverse(const float *const *inRe, const float *const *inIm, float *const *out,
+                                        int numChannels, float *scratch) const {
+
+    auto spectrum = reinterpret_cast<dsp::Complex<float> *>(scratch);
+    auto time = spectrum + size;
+    const int half = size / 2;
+
+    int channelIdx = 0;
+    for (; channelIdx + 1 < numChannels; channelIdx += 2) {
+        const auto aRe = inRe[channelIdx], aIm = inIm[channelIdx];
+        const auto bRe = inRe[channelIdx + 1], bIm = inIm[channelIdx + 1];
+
+        /** A + jB on the non-negative frequencies, conj(A) + j conj(B) mirrored on the negative ones */
+        spectrum[0] = {aRe[0], bRe[0]};
+        spectrum[half] = {aRe[half], bRe[half]};
+        for (auto binIdx = 1; binIdx < half; binIdx++) {
+            spectrum[binIdx] = {aRe[binIdx] - bIm[binIdx], aIm[binIdx] + bRe[binIdx]};
+            spectrum[size - binIdx] = {aRe[binIdx] + bIm[binIdx], bRe[binIdx] - aIm[binIdx]};
+        }
+        fft.perform(spectrum, time, true);
+
+        auto a = out[channelIdx];
+        auto b = out[channelIdx + 1];
+        for (auto smpIdx = 0; smpIdx < size; smpIdx++) {
+            a[smpIdx] = time[smpIdx].real();
+            b[smpIdx] = time[smpIdx].imag();
+        }
+    }
+
+    /** Last channel, if the number of channels is odd */
+    for (; channelIdx < numChannels; channelIdx++) {
+
+        /** Split to interleaved complex. Negative frequencies are filled in by the transform itself */
+        const auto re = inRe[channelIdx];
+        const auto im = inIm[channelIdx];
+        for (auto binIdx = 0; binIdx < getNumBins(); binIdx++) {
+            scratch[2 * binIdx] = re[binIdx];
+            scratch[2 * binIdx + 1] = im[binIdx];
+        }
+        fft.performRealOnlyInverseTransform(scratch);
+        FloatVectorOperations::copy(out[channelIdx], scratch, size);
+    }
+}
+
+// ==============================================================================
+StockhamFFTBackend::StockhamFFTBackend(int order) : FFTBackend(order) {
+
+    jassert(order >= 1);
+
+    complexSize = size / 2;
+
+    twiddleRe.resize(jmax(1, complexSize / 2));
+    twiddleIm.resize(jmax(1, complexSize / 2));
+    for (auto k = 0; k < complexSize / 2; k++) {
+        twiddleRe[k] = (float) cos(2 * MathConstants<double>::pi * k / complexSize);
+        twiddleIm[k] = (float) -sin(2 * MathConstants<double>::pi * k / complexSize);
+    }
+
+    realTwiddleRe.resize(complexSize + 1);
+    realTwiddleIm.resize(complexSize + 1);
+    for (auto k = 0; k <= complexSize; k++) {
+        realTwiddleRe[k] = (float) cos(2 * MathConstants<double>::pi * k / size);
+        realTwiddleIm[k] = (float) -sin(2 * MathConstants<double>::pi * k / size);
+    }
+}
+
+bool StockhamFFTBackend::performComplex(float *re, float *im, float *workRe, float *workIm, bool inverse) const {
+
+    const float sign = inverse ? -1 : 1;
+    float *xRe = re, *xIm = im, *yRe = workRe, *yIm = workIm;
+    bool resultInWork = false;
+
+    /** Each stage halves the length of the sub-transforms and doubles their number (stride) */
+    for (auto length = complexSize, stride = 1; length > 1; length /= 2, stride *= 2) {
+        const int half = length / 2;
+        for (auto p = 0; p < half; p++) {
+            const float wRe = twiddleRe[p * stride];
+            const float wIm = sign * twiddleIm[p * stride];
+            const float *aRe = xRe + stride * p, *aIm = xIm + stride * p;
+            const float *bRe = xRe + stride * (p + half), *bIm = xIm + stride * (p + half);
+            float *sumRe = yRe + stride * 2 * p, *sumIm = yIm + stride * 2 * p;
+            float *diffRe = sumRe + stride, *diffIm = sumIm + stride;
+            for (auto q = 0; q < stride; q++) {
+                const float dRe = aRe[q] - bRe[q];
+                const float dIm = aIm[q] - bIm[q];
+                sumRe[q] = aRe[q] + bRe[q];
+                sumIm[q] = aIm[q] + bIm[q];
+                diffRe[q] = dRe * wRe - dIm * wIm;
+                diffIm[q] = dRe * wIm + dIm * wRe;
+            }
+        }
+        std::swap(xRe, yRe);
+        std::swap(xIm, yIm);
+        resultInWork = !resultInWork;
+    }
+
+    return resultInWork;
+}
+
+void StockhamFFTBackend::performRealForward(const float *const *in, int numSamples, float *const *outRe,
+                                            float *const *outIm, int numChannels, float *scratch) const {
+    jassert(numSamples <= size);
+
+    float *zRe = scratch;
+    float *zIm = scratch + complexSize;
+    float *workRe = scratch + 2 * complexSize;
+    float *workIm = scratch + 3 * complexSize;
+
+    for (auto channelIdx = 0; channelIdx < numChannels; channelIdx++) {
+
+        /** Even samples as real part, odd samples as imaginary part, zero-padded */
+        const auto x = in[channelIdx];
+        const int numPairs = numSamples / 2;
+        for (auto k = 0; k < numPairs; k++) {
+            zRe[k] = x[2 * k];
+            zIm[k] = x[2 * k + 1];
+        }
+        for (auto k = numPairs; k < complexSize; k++) {
+            zRe[k] = 2 * k < numSamples ? x[2 * k] : 0;
+            zIm[k] = 0;
+        }
+
+        const bool resultInWork = performComplex(zRe, zIm, workRe, workIm, false);
+        const float *ZRe = resultInWork ? workRe : zRe;
+        const float *ZIm = resultInWork ? workIm : zIm;
+
+        /** Split the spectra of the even and odd samples and combine them */
+        auto re = outRe[channelIdx];
+        auto im = outIm[channelIdx];
+        for (auto k = 0; k <= complexSize; k++) {
+            const int k1 = k < complexSize ? k : 0;
+            const int k2 = k > 0 ? complexSize - k : 0;
+            const float evenRe = 0.5f * (ZRe[k1] + ZRe[k2]);
+            const float evenIm = 0.5f * (ZIm[k1] - ZIm[k2]);
+            const float oddRe = 0.5f * (ZIm[k1] + ZIm[k2]);
+            const float oddIm = -0.5f * (ZRe[k1] - ZRe[k2]);
+            re[k] = evenRe + oddRe * realTwiddleRe[k] - oddIm * realTwiddleIm[k];
+            im[k] = evenIm + oddRe * realTwiddleIm[k] + oddIm * realTwiddleRe[k];
+        }
+    }
+}
+
+void StockhamFFTBackend::performRealInverse(const float *const *inRe, const float *const *inIm, float *const *out,
+                                            int numChannels, float *scratch) const {
+
+    float *zRe = scratch;
+    float *zIm = scratch + complexSize;
+    float *workRe = scratch + 2 * complexSize;
+    float *workIm = scratch + 3 * complexSize;
+    const float scale = 1.f / complexSize;
+
+    for (auto channelIdx = 0; channelIdx < numChannels; channelIdx++) {
+
+        /** Recover the spectra of the even and odd samples and pack them in a complex spectrum.
+         Imaginary parts of DC and Nyquist are ignored, as they can't belong to a real signal */
+        const auto re = inRe[channelIdx];
+        const auto im = inIm[channelIdx];
+        zRe[0] = 0.5f * (re[0] + re[complexSize]);
+        zIm[0] = 0.5f * (re[0] - re[complexSize]);
+        for (auto k = 1; k < complexSize; k++) {
+            const int k2 = complexSize - k;
+            const float evenRe = 0.5f * (re[k] + re[k2]);
+            const float evenIm = 0.5f * (im[k] - im[k2]);
+            const float dRe = 0.5f * (re[k] - re[k2]);
+            const float dIm = 0.5f * (im[k] + im[k2]);
+            const float oddRe = dRe * realTwiddleRe[k] + dIm * realTwiddleIm[k];
+            const float oddIm = dIm * realTwiddleRe[k] - dRe * realTwiddleIm[k];
+            zRe[k] = evenRe - oddIm;
+            zIm[k] = evenIm + oddRe;
+        }
+
+        const bool resultInWork = performComplex(zRe, zIm, workRe, workIm, true);
+        const float *xRe = resultInWork ? workRe : zRe;
+        const float *xIm = resultInWork ? workIm : zIm;
+
+        auto x = out[channelIdx];
+        for (auto k = 0; k < complexSize; k++) {
+            x[2 * k] = scale * xRe[k];
+            x[2 * k + 1] = scale * xIm[k];
+        }
+    }
+}
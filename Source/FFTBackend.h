@@ -0,0 +1,152 @@
+/*
+ FFT backends
+
+ Authors:
+ Luca Bondi (luca.bondi@polimi.it)
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+/** Available FFT backends */
+typedef enum {
+    FFT_BACKEND_JUCE,
+    FFT_BACKEND_STOCKHAM,
+} FFTBackendType;
+
+/** Real-only FFT of a fixed size, transforming a batch of channels in each call
+
+ Spectra are in split complex form, with the size / 2 + 1 non-negative frequency bins. The inverse transform is
+ scaled so that a forward and an inverse transform give back the original signal.
+ Transforms are const and only use the scratch memory provided by the caller, so the same backend can be shared by
+ multiple objects and threads.
+ Backends must give the same results, Tests/FFTBackendTest checks them against each other.
+ */
+class FFTBackend {
+
+public:
+
+    virtual ~FFTBackend() {};
+
+    /** Create a backend
+
+     @param order: log2 of the FFT size
+     @param type: backend implementation
+     */
+    static std::shared_ptr<FFTBackend> create(int order, FFTBackendType type = defaultType);
+
+    /** Backend used unless specified otherwise */
+    static const FFTBackendType defaultType = FFT_BACKEND_STOCKHAM;
+
+    /** Get the FFT size [samples] */
+    int getSize() const { return size; };
+
+    /** Get the number of non-negative frequency bins, DC and Nyquist included */
+    int getNumBins() const { return size / 2 + 1; };
+
+    /** Get the size of the scratch memory needed by the transforms [floats] */
+    virtual int getScratchSize() const = 0;
+
+    /** Forward transform of a batch of real signals
+
+     @param in: input signals, numSamples each, zero-padded to the FFT size
+     @param numSamples: number of input samples. At most the FFT size
+     @param outRe, outIm: real and imaginary parts of the spectra, getNumBins() each. Must not overlap the inputs
+     @param numChannels: number of signals in the batch
+     @param scratch: getScratchSize() floats
+     */
+    virtual void performRealForward(const float *const *in, int numSamples, float *const *outRe, float *const *outIm,
+                                    int numChannels, float *scratch) const = 0;
+
+    /** Inverse transform of a batch of spectra of real signals
+
+     Imaginary parts of DC and Nyquist are ignored. Backends may transform the channels in pairs.
+     @param inRe, inIm: real and imaginary parts of the spectra, getNumBins() each
+     @param out: output signals, the FFT size each. Must not overlap the inputs
+     @param numChannels: number of spectra in the batch
+     @param scratch: getScratchSize() floats
+     */
+    virtual void performRealInverse(const float *const *inRe, const float *const *inIm, float *const *out,
+                                    int numChannels, float *scratch) const = 0;
+
+protected:
+
+    FFTBackend(int order) : size(1 << order) {};
+
+    /** FFT size [samples] */
+    const int size;
+
+};
+
+// ==============================================================================
+
+/** Backend based on juce::dsp::FFT
+
+ The real-only transforms of JUCE are full size complex transforms, so the inverse transforms are computed two
+ channels at a time: the spectra A and B of two real signals are combined in the spectrum A + jB, whose inverse
+ transform has the first signal as real part and the second one as imaginary part.
+ */
+class JuceFFTBackend : public FFTBackend {
+
+public:
+
+    JuceFFTBackend(int order);
+
+    int getScratchSize() const override { return 4 * size; };
+
+    void performRealForward(const float *const *in, int numSamples, float *const *outRe, float *const *outIm,
+                            int numChannels, float *scratch) const override;
+
+    void performRealInverse(const float *const *inRe, const float *const *inIm, float *const *out, int numChannels,
+                            float *scratch) const override;
+
+private:
+
+    juce::dsp::FFT fft;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (JuceFFTBackend);
+
+};
+
+// ==============================================================================
+
+/** Radix-2 Stockham backend working natively on split complex data
+
+ A real FFT of size N is computed as a complex FFT of size N / 2 on the even and odd samples, followed by a
+ post-processing step. The Stockham formulation needs no bit reversal and all the loops run on contiguous arrays with
+ precomputed twiddle factors, so that they are vectorized by the compiler.
+ */
+class StockhamFFTBackend : public FFTBackend {
+
+public:
+
+    StockhamFFTBackend(int order);
+
+    int getScratchSize() const override { return 2 * size; };
+
+    void performRealForward(const float *const *in, int numSamples, float *const *outRe, float *const *outIm,
+                            int numChannels, float *scratch) const override;
+
+    void performRealInverse(const float *const *inRe, const float *const *inIm, float *const *out, int numChannels,
+                            float *scratch) const override;
+
+private:
+
+    /** Size of the complex FFT, half the real one */
+    int complexSize;
+
+    /** Complex FFT twiddle factors, exp(-j 2 pi k / complexSize) for k < complexSize / 2 */
+    std::vector<float> twiddleRe;
+    std::vector<float> twiddleIm;
+
+    /** Real FFT post-processing twiddle factors, exp(-j 2 pi k / size) for k <= complexSize */
+    std::vector<float> realTwiddleRe;
+    std::vector<float> realTwiddleIm;
+
+    /** Complex FFT, using work as ping-pong buffer. Returns true if the result ended up in work */
+    bool performComplex(float *re, float *im, float *workRe, float *workIm, bool inverse) const;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (StockhamFFTBackend);
+
+};
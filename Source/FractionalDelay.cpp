@@ -0,0 +1,269 @@
+/*
+ Time-domain fractional delay rendering
+
+ Authors:
+ Luca Bondi (luca.bondi@polimi.it)
+*/
+
+#include "FractionalDelay.h"
+
+// ==============================================================================
+DelayLines::DelayLines(int numInputs_, int maxDelay, int numTaps_, int maximumExpectedSamplesPerBlock_) {
+    numInputs = numInputs_;
+    numTaps = numTaps_;
+    maximumExpectedSamplesPerBlock = maximumExpectedSamplesPerBlock_;
+    historyLen = maxDelay + numTaps;
+
+    lines.setSize(numInputs, historyLen + maximumExpectedSamplesPerBlock);
+    reset();
+}
+
+void DelayLines::reset() {
+    lines.clear();
+}
+
+void DelayLines::append(const AudioBuffer<float> &in) {
+    const int numSamples = in.getNumSamples();
+    jassert(numSamples <= maximumExpectedSamplesPerBlock);
+
+    for (auto inCh = 0; inCh < numInputs; inCh++) {
+        if (inCh < in.getNumChannels()) {
+            lines.copyFrom(inCh, historyLen, in, inCh, 0, numSamples);
+        } else {
+            lines.clear(inCh, historyLen, numSamples);
+        }
+    }
+}
+
+void DelayLines::advance(int numSamples) {
+    for (auto inCh = 0; inCh < numInputs; inCh++) {
+        auto data = lines.getWritePointer(inCh);
+        memmove(data, data + numSamples, historyLen * sizeof(float));
+    }
+}
+
+// ==============================================================================
+FractionalDelayRenderer::FractionalDelayRenderer(int numInputs_, int numOutputs_, int maxDelay,
+                                                 int maximumExpectedSamplesPerBlock_, int numTaps_)
+        : delayLines(numInputs_, maxDelay, numTaps_, maximumExpectedSamplesPerBlock_) {
+
+    jassert(numTaps_ >= 2 && numTaps_ % 2 == 0);
+
+    numInputs = numInputs_;
+    numOutputs = numOutputs_;
+    numTaps = numTaps_;
+
+    firstTapDelays.resize(numInputs, std::vector<int>(numOutputs, 0));
+    active.resize(numInputs, std::vector<bool>(numOutputs, false));
+    coefficients.resize(numInputs);
+    for (auto &c : coefficients) {
+        c.setSize(numOutputs, numTaps);
+        c.clear();
+    }
+    designedDelays.resize(numInputs, Vec::Zero(numOutputs));
+    designedGains.resize(numInputs, Vec::Zero(numOutputs));
+
+    /** Kaiser-windowed sinc filters, each one centered on its fractional delay */
+    filtersTable.setSize(numFractions + 1, numTaps);
+    for (auto fracIdx = 0; fracIdx <= numFractions; fracIdx++) {
+        const double center = numTaps / 2 - 1 + double(fracIdx) / numFractions;
+        auto c = filtersTable.getWritePointer(fracIdx);
+        for (auto tapIdx = 0; tapIdx < numTaps; tapIdx++) {
+            c[tapIdx] = (float) kaiserSincTap(tapIdx - center, numTaps, kaiserBeta);
+        }
+    }
+
+    reset();
+}
+
+void FractionalDelayRenderer::reset() {
+    delayLines.reset();
+}
+
+void FractionalDelayRenderer::setDelaysAndGains(int inputIdx, const Vec &delays, const Vec &gains) {
+    jassert(inputIdx < numInputs);
+    jassert(delays.size() >= numOutputs && gains.size() >= numOutputs);
+
+    auto &designedDelay = designedDelays[inputIdx];
+    auto &designedGain = designedGains[inputIdx];
+    for (auto outCh = 0; outCh < numOutputs; outCh++) {
+
+        const float gain = gains(outCh);
+        active[inputIdx][outCh] = gain != 0;
+        if (!active[inputIdx][outCh]) {
+            designedGain(outCh) = 0;
+            continue;
+        }
+
+        /** The filter is centered on the delay */
+        const float delay = delayLines.clampDelay(delays(outCh));
+        if (std::abs(delay - designedDelay(outCh)) <= delayTolerance &&
+            std::abs(gain - designedGain(outCh)) <= gainTolerance * std::abs(designedGain(outCh)))
+            continue;
+        designedDelay(outCh) = delay;
+        designedGain(outCh) = gain;
+
+        const int firstTapDelay = (int) floor(delay) - numTaps / 2 + 1;
+        firstTapDelays[inputIdx][outCh] = firstTapDelay;
+
+        /** Linear interpolation between the two closest fractional delays of the table */
+        const float pos = (delay - floor(delay)) * numFractions;
+        const int fracIdx = jmin((int) pos, numFractions - 1);
+        const float weight = pos - fracIdx;
+        auto c = coefficients[inputIdx].getWritePointer(outCh);
+        FloatVectorOperations::copyWithMultiply(c, filtersTable.getReadPointer(fracIdx), gain * (1 - weight),
+                                                numTaps);
+        FloatVectorOperations::addWithMultiply(c, filtersTable.getReadPointer(fracIdx + 1), gain * weight, numTaps);
+    }
+}
+
+void FractionalDelayRenderer::process(const AudioBuffer<float> &in, AudioBuffer<float> &out) {
+
+    const int numSamples = in.getNumSamples();
+    jassert(out.getNumChannels() >= numOutputs);
+
+    delayLines.append(in);
+
+    /** Each tap is a delayed and scaled copy of the input, vectorized along the block */
+    for (auto outCh = 0; outCh < numOutputs; outCh++) {
+        out.clear(outCh, 0, numSamples);
+        auto outData = out.getWritePointer(outCh);
+        for (auto inCh = 0; inCh < numInputs; inCh++) {
+            if (!active[inCh][outCh])
+                continue;
+            const auto c = coefficients[inCh].getReadPointer(outCh);
+            const auto firstTap = delayLines.getBlock(inCh) - firstTapDelays[inCh][outCh];
+            for (auto tapIdx = 0; tapIdx < numTaps; tapIdx++) {
+                FloatVectorOperations::addWithMultiply(outData, firstTap - tapIdx, c[tapIdx], numSamples);
+            }
+        }
+    }
+
+    delayLines.advance(numSamples);
+
+}
+
+// ==============================================================================
+VariableDelayRenderer::VariableDelayRenderer(int numInputs_, int numOutputs_, int maxDelay,
+                                             int maximumExpectedSamplesPerBlock_, int numTaps_, int polyOrder_)
+        : delayLines(numInputs_, maxDelay, numTaps_, maximumExpectedSamplesPerBlock_) {
+
+    jassert(numTaps_ >= 2 && numTaps_ % 2 == 0);
+    jassert(polyOrder_ >= 1);
+
+    numInputs = numInputs_;
+    numOutputs = numOutputs_;
+    numTaps = numTaps_;
+    polyOrder = polyOrder_;
+
+    /** Least squares fit of each tap of the Kaiser-windowed sinc over a grid of fractional delays */
+    const int numFractions = 64;
+    Eigen::MatrixXd powers(numFractions + 1, polyOrder + 1);
+    Eigen::MatrixXd taps(numFractions + 1, numTaps);
+    for (auto fracIdx = 0; fracIdx <= numFractions; fracIdx++) {
+        const double frac = double(fracIdx) / numFractions;
+        for (auto order = 0; order <= polyOrder; order++) {
+            powers(fracIdx, order) = pow(frac, order);
+        }
+        const double center = numTaps / 2 - 1 + frac;
+        for (auto tapIdx = 0; tapIdx < numTaps; tapIdx++) {
+            taps(fracIdx, tapIdx) = kaiserSincTap(tapIdx - center, numTaps, kaiserBeta);
+        }
+    }
+    const Eigen::MatrixXd fit = powers.colPivHouseholderQr().solve(taps);
+
+    farrowCoefficients.setSize(polyOrder + 1, numTaps);
+    for (auto order = 0; order <= polyOrder; order++) {
+        for (auto tapIdx = 0; tapIdx < numTaps; tapIdx++) {
+            farrowCoefficients.setSample(order, numTaps - 1 - tapIdx, (float) fit(order, tapIdx));
+        }
+    }
+    subFilterOutputs.resize(polyOrder + 1);
+
+    currentDelays.resize(numInputs, Vec::Zero(numOutputs));
+    currentGains.resize(numInputs, Vec::Zero(numOutputs));
+    targetDelays.resize(numInputs, Vec::Zero(numOutputs));
+    targetGains.resize(numInputs, Vec::Zero(numOutputs));
+    snapToTarget.resize(numInputs, true);
+
+    reset();
+}
+
+void VariableDelayRenderer::reset() {
+    delayLines.reset();
+    std::fill(snapToTarget.begin(), snapToTarget.end(), true);
+}
+
+void VariableDelayRenderer::setDelaysAndGains(int inputIdx, const Vec &delays, const Vec &gains) {
+    jassert(inputIdx < numInputs);
+    jassert(delays.size() >= numOutputs && gains.size() >= numOutputs);
+
+    /** Limited at both ends, so that any delay along the block is within the limits too */
+    targetDelays[inputIdx] = delays.head(numOutputs).cwiseMax(delayLines.getMinDelay())
+                                                    .cwiseMin(delayLines.getMaxDelay());
+    targetGains[inputIdx] = gains.head(numOutputs);
+
+    if (snapToTarget[inputIdx]) {
+        currentDelays[inputIdx] = targetDelays[inputIdx];
+        currentGains[inputIdx] = targetGains[inputIdx];
+        snapToTarget[inputIdx] = false;
+    }
+}
+
+void VariableDelayRenderer::process(const AudioBuffer<float> &in, AudioBuffer<float> &out) {
+
+    const int numSamples = in.getNumSamples();
+    jassert(out.getNumChannels() >= numOutputs);
+
+    delayLines.append(in);
+
+    for (auto outCh = 0; outCh < numOutputs; outCh++) {
+        out.clear(outCh, 0, numSamples);
+        auto outData = out.getWritePointer(outCh);
+        for (auto inCh = 0; inCh < numInputs; inCh++) {
+            const float startGain = currentGains[inCh](outCh);
+            const float endGain = targetGains[inCh](outCh);
+            if (startGain == 0 && endGain == 0)
+                continue;
+
+            const float startDelay = currentDelays[inCh](outCh);
+            const float delayStep = (targetDelays[inCh](outCh) - startDelay) / numSamples;
+            const float gainStep = (endGain - startGain) / numSamples;
+            const auto line = delayLines.getBlock(inCh);
+
+            for (auto smpIdx = 0; smpIdx < numSamples; smpIdx++) {
+                const float delay = startDelay + (smpIdx + 1) * delayStep;
+                const int intDelay = (int) floor(delay);
+                const float frac = delay - intDelay;
+
+                /** Oldest sample of the interpolation window */
+                const auto window = line + smpIdx - intDelay - numTaps / 2;
+
+                /** Sub-filters outputs, then polynomial evaluation with Horner's method */
+                for (auto order = 0; order <= polyOrder; order++) {
+                    const auto c = farrowCoefficients.getReadPointer(order);
+                    float acc = 0;
+                    for (auto tapIdx = 0; tapIdx < numTaps; tapIdx++) {
+                        acc += c[tapIdx] * window[tapIdx];
+                    }
+                    subFilterOutputs[order] = acc;
+                }
+                float value = subFilterOutputs[polyOrder];
+                for (auto order = polyOrder - 1; order >= 0; order--) {
+                    value = value * frac + subFilterOutputs[order];
+                }
+
+                outData[smpIdx] += (startGain + (smpIdx + 1) * gainStep) * value;
+            }
+        }
+    }
+
+    /** Targets reached */
+    for (auto inCh = 0; inCh < numInputs; inCh++) {
+        currentDelays[inCh] = targetDelays[inCh];
+        currentGains[inCh] = targetGains[inCh];
+    }
+
+    delayLines.advance(numSamples);
+
+}
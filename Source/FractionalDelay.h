@@ -0,0 +1,243 @@
+/*
+ Time-domain fractional delay rendering
+
+ Authors:
+ Luca Bondi (luca.bondi@polimi.it)
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "SignalProcessing.h"
+
+/** Delay lines of the fractional delay renderers, one per input
+
+ Each line holds the history reached by the longest delay, followed by the current block.
+ */
+class DelayLines {
+
+public:
+
+    /** Initialize the delay lines
+
+     @param numInputs: number of input channels
+     @param maxDelay: maximum delay [samples]
+     @param numTaps: length of the interpolation filters [samples]
+     @param maximumExpectedSamplesPerBlock: maximum block size [samples]
+     */
+    DelayLines(int numInputs, int maxDelay, int numTaps, int maximumExpectedSamplesPerBlock);
+
+    /** Clear the delay lines */
+    void reset();
+
+    /** Append a new block, one channel per input. Missing channels are silent */
+    void append(const AudioBuffer<float> &in);
+
+    /** Keep the most recent samples as history, once the block appended last is processed */
+    void advance(int numSamples);
+
+    /** Get the first sample of the current block of an input, the history is before it */
+    const float *getBlock(int inputIdx) const { return lines.getReadPointer(inputIdx, historyLen); }
+
+    /** Smallest and largest delay an interpolation filter can be centered on, with all the taps causal and within
+     the history [samples] */
+    float getMinDelay() const { return numTaps / 2 - 1; }
+    float getMaxDelay() const { return historyLen - numTaps - 1; }
+
+    /** Limit a delay to the ones an interpolation filter can be centered on [samples] */
+    float clampDelay(float delay) const { return jlimit(getMinDelay(), getMaxDelay(), delay); }
+
+private:
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (DelayLines);
+
+    /** Number of inputs */
+    int numInputs;
+
+    /** Interpolation filters length [samples] */
+    int numTaps;
+
+    /** Maximum block size [samples] */
+    int maximumExpectedSamplesPerBlock;
+
+    /** History length [samples] */
+    int historyLen;
+
+    /** One channel per input. History followed by the current block */
+    AudioBuffer<float> lines;
+
+};
+
+// ==============================================================================
+
+/** Renders delay-and-sum scenes with fractional delay lines instead of FIR convolution
+
+ Each input is stored in its own delay line. Each output is the sum of all the inputs, each one delayed and scaled
+ by its own amount, with delays interpolated by a short Kaiser-windowed sinc filter.
+ Cost is proportional to the number of outputs times the number of taps, with no FFT and no additional latency.
+ Filters are interpolated from a table over the fractional delays, computed at construction, and only for the
+ outputs whose delay or gain changed since they were last designed.
+ */
+class FractionalDelayRenderer {
+
+public:
+
+    /** Initialize the renderer
+
+     @param numInputs: number of input channels
+     @param numOutputs: number of output channels
+     @param maxDelay: maximum delay [samples]
+     @param maximumExpectedSamplesPerBlock: maximum block size [samples]
+     @param numTaps: length of the interpolation filters [samples]. Must be even
+     */
+    FractionalDelayRenderer(int numInputs, int numOutputs, int maxDelay, int maximumExpectedSamplesPerBlock,
+                            int numTaps = 16);
+
+    /** Clear the delay lines */
+    void reset();
+
+    /** Set the delays and the gains from an input to all the outputs
+
+     Changes within delayTolerance and gainTolerance keep the current filters.
+     @param inputIdx: input channel
+     @param delays: delays, one element per output [samples]. Must be at least numTaps / 2 - 1
+     @param gains: gains, one element per output
+     */
+    void setDelaysAndGains(int inputIdx, const Vec &delays, const Vec &gains);
+
+    /** Process a new block of samples
+
+     @param in: input buffer, one channel per input
+     @param out: output buffer, one channel per output. The first in.getNumSamples() samples are overwritten
+     */
+    void process(const AudioBuffer<float> &in, AudioBuffer<float> &out);
+
+    /** Get the length of the interpolation filters [samples] */
+    int getNumTaps() const { return numTaps; };
+
+private:
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (FractionalDelayRenderer);
+
+    /** Number of inputs */
+    int numInputs;
+
+    /** Number of outputs */
+    int numOutputs;
+
+    /** Interpolation filters length [samples] */
+    int numTaps;
+
+    /** Fractional delays in the filters table, between two consecutive integer delays. The linear interpolation
+     between them adds an error well below the one of the filters */
+    static const int numFractions = 256;
+
+    /** Largest change of delay [samples] and relative change of gain that keep the current filters */
+    const float delayTolerance = 1e-3;
+    const float gainTolerance = 1e-4;
+
+    /** Delay lines, one per input */
+    DelayLines delayLines;
+
+    /** Unit gain filters, one channel for each fractional delay from 0 to 1 in numFractions steps */
+    AudioBuffer<float> filtersTable;
+
+    /** Delays [samples] and gains the filters were designed for, one vector of outputs per input */
+    std::vector<Vec> designedDelays;
+    std::vector<Vec> designedGains;
+
+    /** Integer part of the delay of the first tap, one vector of outputs per input [samples] */
+    std::vector<std::vector<int>> firstTapDelays;
+
+    /** Interpolation filters including the gain, one buffer per input with one channel per output */
+    std::vector<AudioBuffer<float>> coefficients;
+
+    /** Whether an output is active (non-zero gain), one vector of outputs per input */
+    std::vector<std::vector<bool>> active;
+
+};
+
+// ==============================================================================
+
+/** Renders delay-and-sum scenes with delays that can change at every sample, through a Farrow structure
+
+ The taps of the Kaiser-windowed sinc interpolator are approximated by polynomials of the fractional delay,
+ fitted once at construction. Each output sample evaluates the polynomials at its own fractional delay, so that
+ delays and gains can be linearly interpolated along the block from the previous values to the new ones.
+ Moving sources are rendered with no filter redesign and no zipper noise, at a cost of (polyOrder + 1)
+ multiply-adds per tap.
+ */
+class VariableDelayRenderer {
+
+public:
+
+    /** Initialize the renderer
+
+     @param numInputs: number of input channels
+     @param numOutputs: number of output channels
+     @param maxDelay: maximum delay [samples]
+     @param maximumExpectedSamplesPerBlock: maximum block size [samples]
+     @param numTaps: length of the interpolation filters [samples]. Must be even
+     @param polyOrder: order of the polynomials approximating each tap
+     */
+    VariableDelayRenderer(int numInputs, int numOutputs, int maxDelay, int maximumExpectedSamplesPerBlock,
+                          int numTaps = 16, int polyOrder = 4);
+
+    /** Clear the delay lines. The next delays and gains are applied with no interpolation */
+    void reset();
+
+    /** Set the delays and the gains from an input to all the outputs, to be reached at the end of the next block
+
+     @param inputIdx: input channel
+     @param delays: delays, one element per output [samples]. Must be at least numTaps / 2 - 1
+     @param gains: gains, one element per output
+     */
+    void setDelaysAndGains(int inputIdx, const Vec &delays, const Vec &gains);
+
+    /** Process a new block of samples
+
+     @param in: input buffer, one channel per input
+     @param out: output buffer, one channel per output. The first in.getNumSamples() samples are overwritten
+     */
+    void process(const AudioBuffer<float> &in, AudioBuffer<float> &out);
+
+    /** Get the length of the interpolation filters [samples] */
+    int getNumTaps() const { return numTaps; };
+
+private:
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (VariableDelayRenderer);
+
+    /** Number of inputs */
+    int numInputs;
+
+    /** Number of outputs */
+    int numOutputs;
+
+    /** Interpolation filters length [samples] */
+    int numTaps;
+
+    /** Order of the polynomials */
+    int polyOrder;
+
+    /** Delay lines, one per input */
+    DelayLines delayLines;
+
+    /** Farrow coefficients, one channel per polynomial order. Taps in reverse order, oldest sample first */
+    AudioBuffer<float> farrowCoefficients;
+
+    /** Delays [samples] and gains at the end of the last processed block, one vector of outputs per input */
+    std::vector<Vec> currentDelays;
+    std::vector<Vec> currentGains;
+
+    /** Delays [samples] and gains to be reached at the end of the next block, one vector of outputs per input */
+    std::vector<Vec> targetDelays;
+    std::vector<Vec> targetGains;
+
+    /** Whether the next targets of each input must be applied with no interpolation */
+    std::vector<bool> snapToTarget;
+
+    /** Output of each Farrow sub-filter for the current sample */
+    std::vector<float> subFilterOutputs;
+
+};
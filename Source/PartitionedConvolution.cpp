@@ -0,0 +1,723 @@
+/*
+ Partitioned convolution engines
+
+ Authors:
+ Luca Bondi (luca.bondi@polimi.it)
+*/
+
+#include "PartitionedConvolution.h"
+
+// ==============================================================================
+UniformPartitionedConvolution::ImpulseResponse::ImpulseResponse(const UniformPartitionedConvolution &engine)
+        : ImpulseResponse(engine, engine.numOutputs) {
+}
+
+UniformPartitionedConvolution::ImpulseResponse::ImpulseResponse(const UniformPartitionedConvolution &engine,
+                                                                int numChannels) {
+
+    numOutputs = numChannels;
+    partitionSize = engine.partitionSize;
+
+    auto fft = engine.fft;
+    segments.resize(engine.numPartitions);
+    for (auto &segment : segments) {
+        segment = AudioBufferFFT(numOutputs, fft);
+    }
+    active.resize(numOutputs, false);
+    activeOutputs.resize(numOutputs);
+    timeSegment.setSize(numOutputs, partitionSize);
+}
+
+void UniformPartitionedConvolution::ImpulseResponse::set(const AudioBuffer<float> &ir, int irStartSample) {
+
+    const int numPartitions = (int) segments.size();
+
+    int numActive = 0;
+    for (auto outCh = 0; outCh < numOutputs; outCh++) {
+        active[outCh] = false;
+        if (outCh < ir.getNumChannels()) {
+            const int numSamples = jmin(numPartitions * partitionSize, ir.getNumSamples() - irStartSample);
+            if (numSamples > 0) {
+                const auto range = FloatVectorOperations::findMinAndMax(ir.getReadPointer(outCh, irStartSample),
+                                                                        numSamples);
+                active[outCh] = range.getStart() != 0 || range.getEnd() != 0;
+            }
+        }
+        if (active[outCh]) {
+            activeOutputs[numActive++] = outCh;
+        }
+    }
+
+    /** Silent impulse responses are never used, their spectra are not even computed */
+    for (auto partitionIdx = 0; partitionIdx < numPartitions; partitionIdx++) {
+        const int startSample = irStartSample + partitionIdx * partitionSize;
+        const int numSamples = jmin(partitionSize, ir.getNumSamples() - startSample);
+
+        timeSegment.clear();
+        if (numSamples > 0) {
+            for (auto idx = 0; idx < numActive; idx++) {
+                const int outCh = activeOutputs[idx];
+                timeSegment.copyFrom(outCh, 0, ir, outCh, startSample, numSamples);
+            }
+        }
+
+        /** Zero-padded to the FFT size */
+        segments[partitionIdx].setTimeSeries(timeSegment, activeOutputs.data(), numActive);
+    }
+}
+
+void UniformPartitionedConvolution::ImpulseResponse::setWeightedSum(int outputIdx, const ImpulseResponse &source,
+                                                                    int firstChannel, const float *weights,
+                                                                    int numWeights) {
+    jassert(outputIdx < numOutputs);
+    jassert(firstChannel + numWeights <= source.numOutputs);
+    jassert(source.partitionSize == partitionSize && source.segments.size() == segments.size());
+
+    active[outputIdx] = false;
+    for (auto weightIdx = 0; weightIdx < numWeights; weightIdx++) {
+        const int channel = firstChannel + weightIdx;
+        if (weights[weightIdx] == 0 || !source.active[channel])
+            continue;
+
+        /** Real and imaginary parts are contiguous, a single operation for both */
+        for (auto partitionIdx = 0; partitionIdx < segments.size(); partitionIdx++) {
+            auto &segment = segments[partitionIdx];
+            const auto src = source.segments[partitionIdx].getRealPointer(channel);
+            if (active[outputIdx]) {
+                FloatVectorOperations::addWithMultiply(segment.getRealWritePointer(outputIdx), src,
+                                                       weights[weightIdx], segment.getNumSamples());
+            } else {
+                FloatVectorOperations::copyWithMultiply(segment.getRealWritePointer(outputIdx), src,
+                                                        weights[weightIdx], segment.getNumSamples());
+            }
+        }
+        active[outputIdx] = true;
+    }
+}
+
+// ==============================================================================
+UniformPartitionedConvolution::UniformPartitionedConvolution(int numInputs_, int numOutputs_, int partitionSize_,
+                                                             int irLen, FFTBackendType fftBackend,
+                                                             bool enableCrossfade) {
+
+    jassert(isPowerOfTwo(partitionSize_));
+
+    numInputs = numInputs_;
+    numOutputs = numOutputs_;
+    partitionSize = partitionSize_;
+    numPartitions = jmax(1, (irLen + partitionSize - 1) / partitionSize);
+    crossfadeLength = partitionSize;
+
+    /** Create shared FFT object. Overlap-save needs twice the partition size */
+    fft = FFTBackend::create(roundToInt(log2(2 * partitionSize)), fftBackend);
+
+    /** Allocate impulse responses, initially silent */
+    ownedImpulseResponses.resize(enableCrossfade ? 2 : 1);
+    for (auto &set : ownedImpulseResponses) {
+        set.resize(numInputs);
+        for (auto &ir : set) {
+            ir = std::make_unique<ImpulseResponse>(*this);
+        }
+    }
+    impulseResponses.resize(numInputs);
+    for (auto inCh = 0; inCh < numInputs; inCh++) {
+        impulseResponses[inCh] = ownedImpulseResponses[0][inCh].get();
+    }
+    pendingImpulseResponses.resize(numInputs, nullptr);
+    irInUse.resize(numOutputs, std::vector<bool>(numInputs, false));
+    outputActive.resize(numOutputs, false);
+
+    /** Allocate the frequency-domain delay line */
+    inputSegments.resize(numPartitions);
+    for (auto &segment : inputSegments) {
+        segment = AudioBufferFFT(numInputs, fft);
+    }
+    inputWindow.setSize(numInputs, 2 * partitionSize);
+    segmentActive.resize(numPartitions, std::vector<bool>(numInputs, false));
+    inputActive.resize(numInputs, false);
+    activeInputsList.resize(numInputs);
+
+    /** Allocate convolution buffers */
+    tailBuffer = AudioBufferFFT(numOutputs, fft);
+    convolutionBuffer = AudioBufferFFT(numOutputs, fft);
+    convolutionTime.setSize(numOutputs, 2 * partitionSize);
+    if (enableCrossfade) {
+        pendingTailBuffer = AudioBufferFFT(numOutputs, fft);
+        pendingConvolutionBuffer = AudioBufferFFT(numOutputs, fft);
+        pendingConvolutionTime.setSize(numOutputs, 2 * partitionSize);
+    }
+
+    /** Allocate tiles */
+    numTiles = (numOutputs + tileSize - 1) / tileSize;
+    tileScratch.resize(numTiles);
+    tileMacTicks.resize(numTiles, 0);
+    tileInverseTicks.resize(numTiles, 0);
+    for (auto &s : tileScratch) {
+        s.calloc(convolutionBuffer.getScratchSize());
+    }
+    tileTailStale = std::vector<std::atomic<bool>>(numTiles);
+    for (auto &stale : tileTailStale) {
+        stale = false;
+    }
+
+    /** Allocate the buffers of the tiles processed with fallback */
+    const int numTileOutputs = jmin(numOutputs, tileSize);
+    fallbackTailBuffer = AudioBufferFFT(numTileOutputs, fft);
+    fallbackConvolutionBuffer = AudioBufferFFT(numTileOutputs, fft);
+    fallbackTime.setSize(numTileOutputs, 2 * partitionSize);
+    if (enableCrossfade) {
+        fallbackPendingTailBuffer = AudioBufferFFT(numTileOutputs, fft);
+        fallbackPendingConvolutionBuffer = AudioBufferFFT(numTileOutputs, fft);
+        fallbackPendingTime.setSize(numTileOutputs, 2 * partitionSize);
+    }
+    fallbackScratch.calloc(convolutionBuffer.getScratchSize());
+
+    reset();
+}
+
+UniformPartitionedConvolution::~UniformPartitionedConvolution() {
+    if (workerPool != nullptr) {
+        workerPool->waitForLateWorkers();
+    }
+}
+
+void UniformPartitionedConvolution::reset() {
+    for (auto &segment : inputSegments) {
+        segment.reset();
+    }
+    for (auto &active : segmentActive) {
+        std::fill(active.begin(), active.end(), false);
+    }
+    std::fill(inputActive.begin(), inputActive.end(), false);
+    inputWindow.clear();
+    inputDataPos = 0;
+    currentSegment = 0;
+
+    for (auto inCh = 0; inCh < numInputs; inCh++) {
+        if (pendingImpulseResponses[inCh] != nullptr) {
+            impulseResponses[inCh] = pendingImpulseResponses[inCh];
+            pendingImpulseResponses[inCh] = nullptr;
+        }
+    }
+    numPendingInputs = 0;
+    crossfadePos = 0;
+    pendingTailReady = false;
+    updateOutputActive();
+}
+
+void UniformPartitionedConvolution::setWorkerPool(WorkerPool *pool) {
+    if (workerPool != nullptr) {
+        workerPool->waitForLateWorkers();
+    }
+    workerPool = pool;
+}
+
+void UniformPartitionedConvolution::setProfiler(Profiler *profiler_) {
+    profiler = profiler_;
+    trace = profiler != nullptr ? &profiler->getTraceRecorder() : nullptr;
+}
+
+void UniformPartitionedConvolution::setCrossfadeLength(int numSamples) {
+    crossfadeLength = jmax(1, numSamples);
+}
+
+void UniformPartitionedConvolution::setImpulseResponse(int inputIdx, const AudioBuffer<float> &ir,
+                                                       int irStartSample) {
+    jassert(inputIdx < numInputs);
+
+    /** Any owned impulse response not fading in can be overwritten, the one in use is replaced anyway */
+    const auto &owned = ownedImpulseResponses;
+    const int set = owned.size() > 1 && pendingImpulseResponses[inputIdx] == owned[0][inputIdx].get() ? 1 : 0;
+    owned[set][inputIdx]->set(ir, irStartSample);
+    setImpulseResponse(inputIdx, *owned[set][inputIdx]);
+}
+
+void UniformPartitionedConvolution::setImpulseResponse(int inputIdx, const ImpulseResponse &ir) {
+    jassert(inputIdx < numInputs);
+    jassert(isCompatible(ir));
+
+    /** A pending impulse response would fade back to the previous one */
+    impulseResponses[inputIdx] = &ir;
+    if (pendingImpulseResponses[inputIdx] != nullptr) {
+        pendingImpulseResponses[inputIdx] = &ir;
+    }
+    updateOutputActive();
+}
+
+void UniformPartitionedConvolution::setPendingImpulseResponse(int inputIdx, const AudioBuffer<float> &ir) {
+    jassert(inputIdx < numInputs);
+    jassert(ownedImpulseResponses.size() == 2);
+
+    /** The owned impulse response not in use */
+    const auto &owned = ownedImpulseResponses;
+    const int set = impulseResponses[inputIdx] == owned[0][inputIdx].get() ? 1 : 0;
+    owned[set][inputIdx]->set(ir);
+    setPendingImpulseResponse(inputIdx, *owned[set][inputIdx]);
+}
+
+void UniformPartitionedConvolution::setPendingImpulseResponse(int inputIdx, const ImpulseResponse &ir) {
+    jassert(inputIdx < numInputs);
+    jassert(ownedImpulseResponses.size() == 2);
+    jassert(!isCrossfading());
+    jassert(isCompatible(ir));
+
+    if (pendingImpulseResponses[inputIdx] == nullptr) {
+        numPendingInputs++;
+    }
+    pendingImpulseResponses[inputIdx] = &ir;
+    pendingTailReady = false;
+    updateOutputActive();
+}
+
+bool UniformPartitionedConvolution::isCompatible(const ImpulseResponse &ir) const {
+    return ir.numOutputs == numOutputs && ir.partitionSize == partitionSize && ir.segments.size() == numPartitions;
+}
+
+void UniformPartitionedConvolution::updateOutputActive() {
+    for (auto outCh = 0; outCh < numOutputs; outCh++) {
+        outputActive[outCh] = false;
+        for (auto inCh = 0; inCh < numInputs; inCh++) {
+            const auto pending = pendingImpulseResponses[inCh];
+            irInUse[outCh][inCh] = impulseResponses[inCh]->active[outCh] ||
+                                   (pending != nullptr && pending->active[outCh]);
+            outputActive[outCh] = outputActive[outCh] || irInUse[outCh][inCh];
+        }
+    }
+}
+
+void UniformPartitionedConvolution::process(const AudioBuffer<float> &in, AudioBuffer<float> &out) {
+    render(in, out, false);
+}
+
+void UniformPartitionedConvolution::processAndAccumulate(const AudioBuffer<float> &in, AudioBuffer<float> &out) {
+    render(in, out, true);
+}
+
+void UniformPartitionedConvolution::render(const AudioBuffer<float> &in, AudioBuffer<float> &out, bool accumulate) {
+
+    const int numSamples = in.getNumSamples();
+    jassert(out.getNumChannels() >= numOutputs);
+    jassert(out.getNumSamples() >= numSamples);
+
+    int numSamplesProcessed = 0;
+    while (numSamplesProcessed < numSamples) {
+
+        const bool newBlock = inputDataPos == 0;
+        const int numSamplesToProcess = jmin(numSamples - numSamplesProcessed, partitionSize - inputDataPos);
+
+        /** Append the new samples to the input window */
+        for (auto inCh = 0; inCh < jmin(numInputs, in.getNumChannels()); inCh++) {
+            inputWindow.copyFrom(inCh, partitionSize + inputDataPos, in, inCh, numSamplesProcessed,
+                                 numSamplesToProcess);
+        }
+
+        /** Compute the spectrum of the current input window. Silent windows are just cleared */
+        const auto fftStartTicks = profiler != nullptr ? Time::getHighResolutionTicks() : 0;
+        auto &segment = inputSegments[currentSegment];
+        int numActive = 0;
+        for (auto inCh = 0; inCh < numInputs; inCh++) {
+            const auto range = FloatVectorOperations::findMinAndMax(inputWindow.getReadPointer(inCh),
+                                                                    2 * partitionSize);
+            const bool active = range.getStart() != 0 || range.getEnd() != 0;
+            if (active) {
+                activeInputsList[numActive++] = inCh;
+            } else if (segmentActive[currentSegment][inCh]) {
+                FloatVectorOperations::clear(segment.getRealWritePointer(inCh), segment.getNumSamples());
+            }
+            segmentActive[currentSegment][inCh] = active;
+        }
+        segment.setTimeSeries(inputWindow, activeInputsList.data(), numActive);
+        for (auto inCh = 0; inCh < numInputs; inCh++) {
+            inputActive[inCh] = false;
+            for (const auto &active : segmentActive) {
+                inputActive[inCh] = inputActive[inCh] || active[inCh];
+            }
+        }
+        if (profiler != nullptr) {
+            profiler->record(Profiler::inputFft, fftStartTicks, Time::getHighResolutionTicks());
+        }
+
+        /** Outputs are independent from each other */
+        const bool crossfade = numPendingInputs > 0;
+        tileTarget.out = out.getArrayOfWritePointers();
+        tileTarget.time = convolutionTime.getArrayOfWritePointers();
+        tileTarget.pendingTime = crossfade ? pendingConvolutionTime.getArrayOfWritePointers() : nullptr;
+        tileTarget.accumulate = accumulate;
+        tileTarget.newBlock = newBlock;
+        tileTarget.crossfade = crossfade;
+        tileTarget.newPendingTail = crossfade && (newBlock || !pendingTailReady);
+        tileTarget.startSample = numSamplesProcessed;
+        tileTarget.numSamples = numSamplesToProcess;
+        renderMacTicks = 0;
+        renderInverseTicks = 0;
+        if (workerPool != nullptr) {
+            workerPool->run(*this, numTiles);
+        } else {
+            for (auto tileIdx = 0; tileIdx < numTiles; tileIdx++) {
+                processTile(tileIdx, false);
+                completeTile(tileIdx, false);
+            }
+        }
+        pendingTailReady = crossfade;
+        if (profiler != nullptr) {
+            /** Processing time, regardless of the threads the tiles ran on */
+            profiler->record(Profiler::multiplyAccumulate, renderMacTicks);
+            profiler->record(Profiler::inverseFft, renderInverseTicks);
+        }
+
+        inputDataPos += numSamplesToProcess;
+        numSamplesProcessed += numSamplesToProcess;
+
+        /** Crossfade completed. The pending impulse responses are now in use, and so is their tail */
+        if (crossfade) {
+            crossfadePos += numSamplesToProcess;
+            if (crossfadePos >= crossfadeLength) {
+                for (auto inCh = 0; inCh < numInputs; inCh++) {
+                    if (pendingImpulseResponses[inCh] != nullptr) {
+                        impulseResponses[inCh] = pendingImpulseResponses[inCh];
+                        pendingImpulseResponses[inCh] = nullptr;
+                    }
+                }
+                numPendingInputs = 0;
+                crossfadePos = 0;
+                updateOutputActive();
+                if (inputDataPos < partitionSize) {
+                    /** Tiles still in use by a late worker recompute their tail instead */
+                    for (auto tileIdx = 0; tileIdx < numTiles; tileIdx++) {
+                        if (workerPool != nullptr && !workerPool->isTileIdle(tileIdx)) {
+                            tileTailStale[tileIdx] = true;
+                            continue;
+                        }
+                        for (auto outCh = tileIdx * tileSize; outCh < jmin(numOutputs, (tileIdx + 1) * tileSize);
+                             outCh++) {
+                            tailBuffer.copySpectrum(outCh, pendingTailBuffer, outCh);
+                        }
+                    }
+                }
+            }
+        }
+
+        /** Block completed. Slide the input window and the frequency-domain delay line */
+        if (inputDataPos == partitionSize) {
+            for (auto inCh = 0; inCh < numInputs; inCh++) {
+                inputWindow.copyFrom(inCh, 0, inputWindow, inCh, partitionSize, partitionSize);
+                inputWindow.clear(inCh, partitionSize, partitionSize);
+            }
+            inputDataPos = 0;
+            currentSegment = currentSegment > 0 ? currentSegment - 1 : numPartitions - 1;
+        }
+    }
+
+}
+
+void UniformPartitionedConvolution::accumulatePartitions(AudioBufferFFT &dest, int destCh, int outCh,
+                                                         int startPartition, int endPartition, bool pending) const {
+    for (auto partitionIdx = startPartition; partitionIdx < endPartition; partitionIdx++) {
+        const int segmentIdx = (currentSegment + partitionIdx) % numPartitions;
+        for (auto inCh = 0; inCh < numInputs; inCh++) {
+            const auto pendingIr = pending ? pendingImpulseResponses[inCh] : nullptr;
+            const auto ir = pendingIr != nullptr ? pendingIr : impulseResponses[inCh];
+            if (!segmentActive[segmentIdx][inCh] || !ir->active[outCh])
+                continue;
+            dest.convolveAndAccumulate(destCh, inputSegments[segmentIdx], inCh, ir->segments[partitionIdx], outCh);
+        }
+    }
+}
+
+bool UniformPartitionedConvolution::isOutputLive(int outCh) const {
+    for (auto inCh = 0; inCh < numInputs; inCh++) {
+        if (irInUse[outCh][inCh] && inputActive[inCh])
+            return true;
+    }
+    return false;
+}
+
+void UniformPartitionedConvolution::processTile(int tileIdx, bool fallback) {
+
+    const int startCh = tileIdx * tileSize;
+    const int endCh = jmin(numOutputs, startCh + tileSize);
+    const auto startTicks = profiler != nullptr ? Time::getHighResolutionTicks() : 0;
+    TraceRecorder::ScopedEvent tileEvent(trace, fallback ? "Convolution tile fallback" : "Convolution tile",
+                                         tileIdx);
+
+    /** With fallback the buffers hold the outputs of the tile only, and the tail is always computed afresh */
+    auto &tail = fallback ? fallbackTailBuffer : tailBuffer;
+    auto &pendingTail = fallback ? fallbackPendingTailBuffer : pendingTailBuffer;
+    auto &conv = fallback ? fallbackConvolutionBuffer : convolutionBuffer;
+    auto &pendingConv = fallback ? fallbackPendingConvolutionBuffer : pendingConvolutionBuffer;
+    const auto time = fallback ? fallbackTime.getArrayOfWritePointers() : tileTarget.time;
+    const auto pendingTime = fallback ? fallbackPendingTime.getArrayOfWritePointers() : tileTarget.pendingTime;
+    const int chOffset = fallback ? startCh : 0;
+    const bool stale = fallback || tileTailStale[tileIdx].load(std::memory_order_relaxed);
+
+    /** The contribution of the past input blocks doesn't change until a new block starts.
+     Cleared for inactive outputs too, in case they become active before the next block */
+    if (tileTarget.newBlock || stale) {
+        for (auto outCh = startCh; outCh < endCh; outCh++) {
+            FloatVectorOperations::clear(tail.getRealWritePointer(outCh - chOffset), tail.getNumSamples());
+            if (outputActive[outCh]) {
+                accumulatePartitions(tail, outCh - chOffset, outCh, 1, numPartitions, false);
+            }
+        }
+    }
+    if (tileTarget.crossfade && (tileTarget.newPendingTail || stale)) {
+        for (auto outCh = startCh; outCh < endCh; outCh++) {
+            FloatVectorOperations::clear(pendingTail.getRealWritePointer(outCh - chOffset),
+                                         pendingTail.getNumSamples());
+            if (outputActive[outCh]) {
+                accumulatePartitions(pendingTail, outCh - chOffset, outCh, 1, numPartitions, true);
+            }
+        }
+    }
+
+    /** Add the contribution of the current input block */
+    int activeChannels[tileSize];
+    float *activeTime[tileSize];
+    float *activePendingTime[tileSize];
+    int numActive = 0;
+    for (auto outCh = startCh; outCh < endCh; outCh++) {
+        if (!isOutputLive(outCh))
+            continue;
+        const int ch = outCh - chOffset;
+        conv.copySpectrum(ch, tail, ch);
+        accumulatePartitions(conv, ch, outCh, 0, 1, false);
+        activeChannels[numActive] = ch;
+        activeTime[numActive] = time[ch];
+        if (tileTarget.crossfade) {
+            pendingConv.copySpectrum(ch, pendingTail, ch);
+            accumulatePartitions(pendingConv, ch, outCh, 0, 1, true);
+            activePendingTime[numActive] = pendingTime[ch];
+        }
+        numActive++;
+    }
+
+    const auto macEndTicks = profiler != nullptr ? Time::getHighResolutionTicks() : 0;
+
+    /** Back to time domain, all the active outputs of the tile with a single batched transform.
+     Only the second half of the window is free from circular aliasing */
+    const auto scratch = fallback ? fallbackScratch.get() : tileScratch[tileIdx].get();
+    conv.copyToTimeSeries(activeChannels, numActive, activeTime, scratch);
+    if (tileTarget.crossfade) {
+        pendingConv.copyToTimeSeries(activeChannels, numActive, activePendingTime, scratch);
+    }
+
+    if (profiler != nullptr) {
+        const auto endTicks = Time::getHighResolutionTicks();
+        (fallback ? fallbackMacTicks : tileMacTicks[tileIdx]) = macEndTicks - startTicks;
+        (fallback ? fallbackInverseTicks : tileInverseTicks[tileIdx]) = endTicks - macEndTicks;
+    }
+}
+
+void UniformPartitionedConvolution::completeTile(int tileIdx, bool fallback) {
+
+    const int startCh = tileIdx * tileSize;
+    const int endCh = jmin(numOutputs, startCh + tileSize);
+    const auto time = fallback ? fallbackTime.getArrayOfWritePointers() : tileTarget.time;
+    const auto pendingTime = fallback ? fallbackPendingTime.getArrayOfWritePointers() : tileTarget.pendingTime;
+    const int chOffset = fallback ? startCh : 0;
+
+    /** The tail buffers of the tile were not updated, or are being written by a late worker */
+    tileTailStale[tileIdx].store(fallback, std::memory_order_relaxed);
+
+    for (auto outCh = startCh; outCh < endCh; outCh++) {
+        auto out = tileTarget.out[outCh] + tileTarget.startSample;
+        const auto outTime = time[outCh - chOffset] + partitionSize + inputDataPos;
+        if (!isOutputLive(outCh)) {
+            if (!tileTarget.accumulate) {
+                FloatVectorOperations::clear(out, tileTarget.numSamples);
+            }
+        } else if (tileTarget.crossfade) {
+            /** Linear crossfade, the outputs of the two sets are strongly correlated */
+            const auto outPendingTime = pendingTime[outCh - chOffset] + partitionSize + inputDataPos;
+            for (auto smpIdx = 0; smpIdx < tileTarget.numSamples; smpIdx++) {
+                const float gain = jmin(1.f, float(crossfadePos + smpIdx + 1) / crossfadeLength);
+                const float value = outTime[smpIdx] + gain * (outPendingTime[smpIdx] - outTime[smpIdx]);
+                out[smpIdx] = tileTarget.accumulate ? out[smpIdx] + value : value;
+            }
+        } else if (tileTarget.accumulate) {
+            FloatVectorOperations::add(out, outTime, tileTarget.numSamples);
+        } else {
+            FloatVectorOperations::copy(out, outTime, tileTarget.numSamples);
+        }
+    }
+
+    if (profiler != nullptr) {
+        renderMacTicks += fallback ? fallbackMacTicks : tileMacTicks[tileIdx];
+        renderInverseTicks += fallback ? fallbackInverseTicks : tileInverseTicks[tileIdx];
+    }
+}
+
+// ==============================================================================
+NonUniformPartitionedConvolution::TailStage::TailStage(int numInputs, int numOutputs, int blockSize_,
+                                                       int irOffset_, int irLen, FFTBackendType fftBackend)
+        : Thread("Convolution tail"), blockSize(blockSize_), irOffset(irOffset_),
+          convolution(numInputs, numOutputs, blockSize_, irLen, fftBackend), numSubmitted(0), numCompleted(0) {
+    for (auto &b : inputBlocks) {
+        b.setSize(numInputs, blockSize);
+        b.clear();
+    }
+    for (auto &b : outputBlocks) {
+        b.setSize(numOutputs, blockSize);
+        b.clear();
+    }
+}
+
+NonUniformPartitionedConvolution::TailStage::~TailStage() {
+    stopThread(1000);
+}
+
+void NonUniformPartitionedConvolution::TailStage::run() {
+    while (!threadShouldExit()) {
+        while (numCompleted.load() < numSubmitted.load()) {
+            const int slot = numCompleted.load() % numSlots;
+            convolution.process(inputBlocks[slot], outputBlocks[slot]);
+            numCompleted++;
+        }
+        wait(pollInterval);
+    }
+}
+
+void NonUniformPartitionedConvolution::TailStage::waitForPendingBlocks() const {
+    while (numCompleted.load() < numSubmitted.load()) {
+        Thread::sleep(1);
+    }
+}
+
+// ==============================================================================
+NonUniformPartitionedConvolution::NonUniformPartitionedConvolution(int numInputs_, int numOutputs_,
+                                                                   int headPartitionSize, int irLen_,
+                                                                   int maxBlockSize, FFTBackendType fftBackend)
+        : numLateBlocks(0) {
+
+    numInputs = numInputs_;
+    numOutputs = numOutputs_;
+    irLen = irLen_;
+
+    /** The head covers the impulse responses up to the offset of the first tail stage */
+    int blockSize = growthFactor * headPartitionSize;
+    while (blockSize < maxBlockSize) {
+        blockSize *= 2;
+    }
+    int irOffset = 2 * blockSize;
+    head = std::make_unique<UniformPartitionedConvolution>(numInputs, numOutputs, headPartitionSize,
+                                                           jmin(irLen, irOffset), fftBackend);
+
+    /** Each tail stage ends where the next one, with a larger block size, can start.
+     Stages with shorter blocks have closer deadlines, hence higher priority, all above the normal one */
+    int priority = 8;
+    while (irOffset < irLen) {
+        const int nextIrOffset = 2 * blockSize * growthFactor;
+        const int stageIrLen = jmin(irLen, nextIrOffset) - irOffset;
+        tail.push_back(std::make_unique<TailStage>(numInputs, numOutputs, blockSize, irOffset, stageIrLen,
+                                                   fftBackend));
+        tail.back()->startThread(jmax(6, priority--));
+        blockSize *= growthFactor;
+        irOffset = nextIrOffset;
+    }
+    tailDataPos.resize(tail.size());
+
+    reset();
+}
+
+NonUniformPartitionedConvolution::~NonUniformPartitionedConvolution() {
+    tail.clear();
+}
+
+void NonUniformPartitionedConvolution::reset() {
+    head->reset();
+    for (auto stageIdx = 0; stageIdx < tail.size(); stageIdx++) {
+        auto &stage = *tail[stageIdx];
+        stage.waitForPendingBlocks();
+        stage.convolution.reset();
+        for (auto &b : stage.inputBlocks) {
+            b.clear();
+        }
+        for (auto &b : stage.outputBlocks) {
+            b.clear();
+        }
+        stage.numSubmitted = 0;
+        stage.numCompleted = 0;
+        stage.playSlot = -1;
+        tailDataPos[stageIdx] = 0;
+    }
+}
+
+void NonUniformPartitionedConvolution::setWorkerPool(WorkerPool *pool) {
+    head->setWorkerPool(pool);
+}
+
+void NonUniformPartitionedConvolution::setImpulseResponse(int inputIdx, const AudioBuffer<float> &ir) {
+    head->setImpulseResponse(inputIdx, ir);
+    for (auto &stage : tail) {
+        stage->waitForPendingBlocks();
+        stage->convolution.setImpulseResponse(inputIdx, ir, stage->irOffset);
+    }
+}
+
+void NonUniformPartitionedConvolution::process(const AudioBuffer<float> &in, AudioBuffer<float> &out) {
+    render(in, out, false);
+}
+
+void NonUniformPartitionedConvolution::processAndAccumulate(const AudioBuffer<float> &in, AudioBuffer<float> &out) {
+    render(in, out, true);
+}
+
+void NonUniformPartitionedConvolution::render(const AudioBuffer<float> &in, AudioBuffer<float> &out,
+                                              bool accumulate) {
+
+    /** Head, computed on the calling thread */
+    if (accumulate) {
+        head->processAndAccumulate(in, out);
+    } else {
+        head->process(in, out);
+    }
+
+    /** Tail stages, computed on the background threads */
+    const int numSamples = in.getNumSamples();
+    for (auto stageIdx = 0; stageIdx < tail.size(); stageIdx++) {
+        auto &stage = *tail[stageIdx];
+        int numSamplesProcessed = 0;
+        while (numSamplesProcessed < numSamples) {
+            auto &dataPos = tailDataPos[stageIdx];
+            const int numSamplesToProcess = jmin(numSamples - numSamplesProcessed, stage.blockSize - dataPos);
+            const int numSubmitted = stage.numSubmitted.load();
+            const int slot = numSubmitted % TailStage::numSlots;
+
+            /** Collect the input of the current block */
+            for (auto inCh = 0; inCh < jmin(numInputs, in.getNumChannels()); inCh++) {
+                stage.inputBlocks[slot].copyFrom(inCh, dataPos, in, inCh, numSamplesProcessed, numSamplesToProcess);
+            }
+
+            /** Play the output of the block before the previous one */
+            if (stage.playSlot >= 0) {
+                for (auto outCh = 0; outCh < numOutputs; outCh++) {
+                    out.addFrom(outCh, numSamplesProcessed, stage.outputBlocks[stage.playSlot], outCh, dataPos,
+                                numSamplesToProcess);
+                }
+            }
+
+            dataPos += numSamplesToProcess;
+            numSamplesProcessed += numSamplesToProcess;
+
+            /** Block completed. The previous one is played from now on if ready, silence otherwise. The slot of the
+             next block is still in use if the background thread is two blocks behind: the block is dropped, and
+             the next one collected in its place */
+            if (dataPos == stage.blockSize) {
+                dataPos = 0;
+                const int numCompleted = stage.numCompleted.load();
+                if (numSubmitted - numCompleted >= TailStage::numSlots - 1) {
+                    stage.playSlot = -1;
+                    numLateBlocks.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+                stage.numSubmitted = numSubmitted + 1;
+                if (numCompleted == numSubmitted) {
+                    stage.playSlot = (numSubmitted + TailStage::numSlots - 1) % TailStage::numSlots;
+                } else {
+                    stage.playSlot = -1;
+                    numLateBlocks.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,489 @@
+/*
+ Partitioned convolution engines
+
+ Authors:
+ Luca Bondi (luca.bondi@polimi.it)
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "AudioBufferFFT.h"
+#include "WorkerPool.h"
+#include "Profiler.h"
+
+/** Uniformly partitioned overlap-save convolution with multiple inputs and multiple outputs
+
+ Each output is the sum of all the inputs, each one convolved with its own impulse response.
+ Impulse responses are split in partitions of equal length. The spectra of the past input blocks are kept in a
+ frequency-domain delay line, so that the FFT size only depends on the partition size and not on the length of
+ the impulse responses or on the size of the blocks provided by the host.
+ Blocks shorter than the partition size are processed with no additional latency.
+ Outputs are processed in tiles, optionally spread over the threads of a WorkerPool. A tile abandoned by a late
+ worker is processed again on the calling thread in separate buffers, and its tail is recomputed the next time.
+ Silent impulse responses are skipped, outputs with no active impulse response are cleared with no inverse transform.
+ Inputs made of zeros are skipped too, once the contribution of their past blocks has been played.
+ Optionally, new impulse responses can be faded in, crossfading the outputs of the old and the new ones.
+ Impulse responses can also be transformed on another thread, then handed to the engine at no cost.
+ */
+class UniformPartitionedConvolution : private WorkerPool::Job {
+
+public:
+
+    /** Spectra of the impulse responses from an input to all the outputs, in the format used by an engine
+
+     Computed on any thread, then used by the engine in place until it is replaced.
+     */
+    class ImpulseResponse {
+
+    public:
+
+        /** Allocate silent impulse responses for the given engine, or for any engine with the same number of
+         outputs, partition size and number of partitions */
+        explicit ImpulseResponse(const UniformPartitionedConvolution &engine);
+
+        /** Allocate silent impulse responses in the format of the given engine, with any number of channels.
+         Not to be used by the engine, only as the source of setWeightedSum */
+        ImpulseResponse(const UniformPartitionedConvolution &engine, int numChannels);
+
+        /** Compute the spectra
+
+         Impulse responses made of zeros only are flagged as silent and cost nothing.
+         @param ir: impulse responses, one channel per output. Samples beyond the engine irLen are ignored
+         @param irStartSample: first sample of ir to be used
+         */
+        void set(const AudioBuffer<float> &ir, int irStartSample = 0);
+
+        /** Set the impulse response to an output as a weighted sum of consecutive channels of another one
+
+         Computed in the frequency domain with no transform, e.g. to interpolate between precomputed impulse
+         responses at a fraction of the cost of set.
+         @param outputIdx: output to be set
+         @param source: impulse responses in the same format
+         @param firstChannel: first channel of source to be summed
+         @param weights: one weight per channel of source, from firstChannel on
+         @param numWeights: number of weights
+         */
+        void setWeightedSum(int outputIdx, const ImpulseResponse &source, int firstChannel, const float *weights,
+                            int numWeights);
+
+    private:
+
+        friend class UniformPartitionedConvolution;
+
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ImpulseResponse);
+
+        /** Number of outputs */
+        int numOutputs;
+
+        /** Partition size [samples] */
+        int partitionSize;
+
+        /** Spectra, one buffer per partition with one channel per output */
+        std::vector<AudioBufferFFT> segments;
+
+        /** Whether the impulse response to an output is not silent */
+        std::vector<bool> active;
+
+        /** Outputs with an active impulse response */
+        std::vector<int> activeOutputs;
+
+        /** A single partition in time domain */
+        AudioBuffer<float> timeSegment;
+
+    };
+
+    /** Initialize the convolution engine
+
+     @param numInputs: number of input channels
+     @param numOutputs: number of output channels
+     @param partitionSize: length of each partition [samples]. Must be a power of 2
+     @param irLen: maximum length of the impulse responses [samples]
+     @param fftBackend: FFT implementation
+     @param enableCrossfade: allocate the buffers needed by setPendingImpulseResponse
+     */
+    UniformPartitionedConvolution(int numInputs, int numOutputs, int partitionSize, int irLen,
+                                  FFTBackendType fftBackend = FFTBackend::defaultType, bool enableCrossfade = false);
+
+    /** Destructor. Waits for the late workers to leave the tiles */
+    ~UniformPartitionedConvolution();
+
+    /** Clear the input history. A crossfade in progress is completed, the pending impulse responses are in use */
+    void reset();
+
+    /** Set the impulse responses from an input to all the outputs, with no crossfade
+
+     Impulse responses made of zeros only are flagged as silent and cost nothing.
+     @param inputIdx: input channel
+     @param ir: impulse responses, one channel per output. Samples beyond irLen are ignored
+     @param irStartSample: first sample of ir to be used
+     */
+    void setImpulseResponse(int inputIdx, const AudioBuffer<float> &ir, int irStartSample = 0);
+
+    /** Same as above, with impulse responses already transformed. No copy is made, ir is used until replaced */
+    void setImpulseResponse(int inputIdx, const ImpulseResponse &ir);
+
+    /** Set the impulse responses from an input to all the outputs, crossfading from the current ones
+
+     All the impulse responses set before the next block fade in together. Not to be called while isCrossfading().
+     @param inputIdx: input channel
+     @param ir: impulse responses, one channel per output. Samples beyond irLen are ignored
+     */
+    void setPendingImpulseResponse(int inputIdx, const AudioBuffer<float> &ir);
+
+    /** Same as above, with impulse responses already transformed. No copy is made, ir is used until replaced.
+     The impulse responses being replaced are used until the crossfade is completed */
+    void setPendingImpulseResponse(int inputIdx, const ImpulseResponse &ir);
+
+    /** Whether a crossfade is in progress. No new pending impulse responses can be set until it's completed */
+    bool isCrossfading() const { return crossfadePos > 0; };
+
+    /** Set the crossfade length [samples], applied from the next crossfade */
+    void setCrossfadeLength(int numSamples);
+
+    /** Process a new block of samples
+
+     @param in: input buffer, one channel per input. Any number of samples is supported
+     @param out: output buffer, one channel per output. The first in.getNumSamples() samples are overwritten
+     */
+    void process(const AudioBuffer<float> &in, AudioBuffer<float> &out);
+
+    /** Same as process, but the result is added to the samples already present in out */
+    void processAndAccumulate(const AudioBuffer<float> &in, AudioBuffer<float> &out);
+
+    /** Process the outputs on a pool of worker threads
+
+     Not to be called concurrently with process.
+     @param pool: worker threads pool, nullptr to process all the outputs on the calling thread
+     */
+    void setWorkerPool(WorkerPool *pool);
+
+    /** Record the timings of the input FFT, the multiply-accumulate and the inverse FFT, and trace the tiles
+
+     Not to be called concurrently with process.
+     @param profiler: nullptr to stop recording
+     */
+    void setProfiler(Profiler *profiler);
+
+    /** Get the partition size [samples] */
+    int getPartitionSize() const { return partitionSize; };
+
+    /** Get the number of partitions */
+    int getNumPartitions() const { return numPartitions; };
+
+    /** Get the memory used by the spectra of the impulse response from an input to an output [bytes] */
+    size_t getImpulseResponseSize() const {
+        return size_t(numPartitions) * convolutionBuffer.getNumSamples() * sizeof(float);
+    };
+
+private:
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (UniformPartitionedConvolution);
+
+    /** Number of inputs */
+    int numInputs;
+
+    /** Number of outputs */
+    int numOutputs;
+
+    /** Partition size [samples] */
+    int partitionSize;
+
+    /** Number of partitions */
+    int numPartitions;
+
+    /** Shared FFT pointer, twice the partition size */
+    std::shared_ptr<FFTBackend> fft;
+
+    /** Impulse responses set from the time domain, two sets if crossfading is enabled. One vector of inputs per set */
+    std::vector<std::vector<std::unique_ptr<ImpulseResponse>>> ownedImpulseResponses;
+
+    /** Impulse responses in use for each input */
+    std::vector<const ImpulseResponse *> impulseResponses;
+
+    /** Impulse responses fading in for each input, nullptr if none */
+    std::vector<const ImpulseResponse *> pendingImpulseResponses;
+
+    /** Number of inputs with pending impulse responses */
+    int numPendingInputs = 0;
+
+    /** Crossfade length [samples] */
+    int crossfadeLength;
+
+    /** Samples already crossfaded */
+    int crossfadePos = 0;
+
+    /** Whether an impulse response is active in the set in use or in the pending one, one vector of inputs per output */
+    std::vector<std::vector<bool>> irInUse;
+
+    /** Whether an output has at least an active impulse response */
+    std::vector<bool> outputActive;
+
+    /** Frequency-domain delay line. Spectra of the most recent input windows, one channel per input */
+    std::vector<AudioBufferFFT> inputSegments;
+
+    /** Index of the most recent input segment in the delay line */
+    int currentSegment = 0;
+
+    /** Whether an input segment is not silent, one vector of inputs per segment */
+    std::vector<std::vector<bool>> segmentActive;
+
+    /** Whether an input has at least an active segment in the delay line */
+    std::vector<bool> inputActive;
+
+    /** Inputs with an active window in the current segment */
+    std::vector<int> activeInputsList;
+
+    /** Input window in time domain. Previous block followed by the block being filled */
+    AudioBuffer<float> inputWindow;
+
+    /** Position of the next input sample in the block being filled */
+    int inputDataPos = 0;
+
+    /** Contribution of the past input blocks, one channel per output */
+    AudioBufferFFT tailBuffer;
+
+    /** Convolution buffer, one channel per output */
+    AudioBufferFFT convolutionBuffer;
+
+    /** Convolution buffer in time domain, one channel per output */
+    AudioBuffer<float> convolutionTime;
+
+    /** Same as the buffers above, with the pending impulse responses */
+    AudioBufferFFT pendingTailBuffer;
+    AudioBufferFFT pendingConvolutionBuffer;
+    AudioBuffer<float> pendingConvolutionTime;
+
+    /** Whether pendingTailBuffer is up to date for the current block */
+    bool pendingTailReady = false;
+
+    /** Number of outputs in each tile. Even, so that the FFT backend can pair them */
+    static const int tileSize = 8;
+
+    /** Number of tiles */
+    int numTiles;
+
+    /** Scratch memory for the inverse transforms of each tile */
+    std::vector<HeapBlock<float>> tileScratch;
+
+    /** Whether the tail in tailBuffer and pendingTailBuffer is out of date for the outputs of a tile, after the tile
+     was processed with fallback. Read by late workers too */
+    std::vector<std::atomic<bool>> tileTailStale;
+
+    /** Same as tailBuffer, pendingTailBuffer, convolutionBuffer, pendingConvolutionBuffer, convolutionTime and
+     pendingConvolutionTime, one channel per output of a tile, for the tiles processed with fallback */
+    AudioBufferFFT fallbackTailBuffer;
+    AudioBufferFFT fallbackPendingTailBuffer;
+    AudioBufferFFT fallbackConvolutionBuffer;
+    AudioBufferFFT fallbackPendingConvolutionBuffer;
+    AudioBuffer<float> fallbackTime;
+    AudioBuffer<float> fallbackPendingTime;
+    HeapBlock<float> fallbackScratch;
+
+    /** Worker threads, if any */
+    WorkerPool *workerPool = nullptr;
+
+    /** Stages timings destination, if any */
+    Profiler *profiler = nullptr;
+
+    /** Timeline of the tiles, on the threads they run on. nullptr if not profiling */
+    TraceRecorder *trace = nullptr;
+
+    /** Multiply-accumulate and inverse transform time of each tile, last render step [ticks] */
+    std::vector<int64> tileMacTicks;
+    std::vector<int64> tileInverseTicks;
+
+    /** Same as above, for the tile processed with fallback */
+    int64 fallbackMacTicks = 0;
+    int64 fallbackInverseTicks = 0;
+
+    /** Multiply-accumulate and inverse transform time of the tiles completed in the current render step [ticks] */
+    int64 renderMacTicks = 0;
+    int64 renderInverseTicks = 0;
+
+    /** Portion of the output being processed by the tiles */
+    struct {
+        float *const *out;
+        float *const *time;
+        float *const *pendingTime;
+        bool accumulate;
+        bool newBlock;
+        bool crossfade;
+        bool newPendingTail;
+        int startSample;
+        int numSamples;
+    } tileTarget;
+
+    void render(const AudioBuffer<float> &in, AudioBuffer<float> &out, bool accumulate);
+
+    /** Check that impulse responses were allocated for an engine like this one */
+    bool isCompatible(const ImpulseResponse &ir) const;
+
+    /** Update outputActive after a change in the impulse responses */
+    void updateOutputActive();
+
+    /** Accumulate the contribution of a range of partitions to an output spectrum
+     @param destCh: channel of dest
+     @param outCh: output
+     @param pending: use the pending impulse responses, where available
+     */
+    void accumulatePartitions(AudioBufferFFT &dest, int destCh, int outCh, int startPartition, int endPartition,
+                              bool pending) const;
+
+    /** Whether an impulse response in use for an output is fed by an input with some active segment */
+    bool isOutputLive(int outCh) const;
+
+    /** Add up all the partitions and go back to time domain for a tile of outputs */
+    void processTile(int tileIdx, bool fallback) override;
+
+    /** Write the outputs of a tile */
+    void completeTile(int tileIdx, bool fallback) override;
+
+};
+
+// ==============================================================================
+
+/** Non-uniformly partitioned convolution with multiple inputs and multiple outputs, for long impulse responses
+
+ The first part of the impulse responses (head) is convolved on the calling thread with small uniform partitions,
+ hence with no additional latency. The rest (tail) is split in stages with partitions growing by growthFactor.
+ Each tail stage starts at an offset equal to twice its block size, so that each block can be computed on a
+ background thread while the following one is being collected. The first tail stage has blocks at least as long as
+ the blocks given to process, so that the background threads get at least a whole call period for each block.
+ The calling thread never waits for the background threads: a block not completed in time is replaced by silence
+ and counted as late. If a background thread falls two blocks behind, the input block is dropped too.
+ */
+class NonUniformPartitionedConvolution {
+
+public:
+
+    /** Initialize the convolution engine
+
+     @param numInputs: number of input channels
+     @param numOutputs: number of output channels
+     @param headPartitionSize: partition size of the head [samples]. Must be a power of 2
+     @param irLen: maximum length of the impulse responses [samples]
+     @param maxBlockSize: largest number of samples given to process in a row, 0 if not larger than the head block
+     @param fftBackend: FFT implementation
+     */
+    NonUniformPartitionedConvolution(int numInputs, int numOutputs, int headPartitionSize, int irLen,
+                                     int maxBlockSize = 0, FFTBackendType fftBackend = FFTBackend::defaultType);
+
+    /** Destructor. Stops the background threads */
+    ~NonUniformPartitionedConvolution();
+
+    /** Clear the input history
+
+     Waits for the background threads to complete the pending blocks. Not to be called concurrently with process.
+     */
+    void reset();
+
+    /** Set the impulse responses from an input to all the outputs
+
+     Waits for the background threads to complete the pending blocks. Not to be called concurrently with process.
+     @param inputIdx: input channel
+     @param ir: impulse responses, one channel per output. Samples beyond irLen are ignored
+     */
+    void setImpulseResponse(int inputIdx, const AudioBuffer<float> &ir);
+
+    /** Process a new block of samples
+
+     @param in: input buffer, one channel per input. Any number of samples is supported
+     @param out: output buffer, one channel per output. The first in.getNumSamples() samples are overwritten
+     */
+    void process(const AudioBuffer<float> &in, AudioBuffer<float> &out);
+
+    /** Same as process, but the result is added to the samples already present in out */
+    void processAndAccumulate(const AudioBuffer<float> &in, AudioBuffer<float> &out);
+
+    /** Process the outputs of the head on a pool of worker threads
+
+     @param pool: worker threads pool, nullptr to process all the outputs on the calling thread
+     */
+    void setWorkerPool(WorkerPool *pool);
+
+    /** Get the maximum length of the impulse responses [samples] */
+    int getIrLen() const { return irLen; };
+
+    /** Get the number of tail blocks not completed in time, since construction. Any thread */
+    int64 getNumLateBlocks() const { return numLateBlocks.load(std::memory_order_relaxed); }
+
+private:
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (NonUniformPartitionedConvolution);
+
+    /** Block size increase from one stage to the next */
+    static const int growthFactor = 4;
+
+    /** A tail stage, convolving a segment of the impulse responses on its own thread.
+
+     Block j is collected in inputBlocks[j % numSlots], computed while block j+1 is being collected and played from
+     outputBlocks[j % numSlots] while block j+2 is being collected. The third slot lets block j+2 be collected while
+     a late block j is still being computed.
+     */
+    class TailStage : public Thread {
+    public:
+        TailStage(int numInputs, int numOutputs, int blockSize, int irOffset, int irLen, FFTBackendType fftBackend);
+
+        ~TailStage();
+
+        void run() override;
+
+        /** Wait for the background thread to complete all the submitted blocks. Not on the audio thread */
+        void waitForPendingBlocks() const;
+
+        /** Number of blocks buffers */
+        static const int numSlots = 3;
+
+        /** New blocks are polled for, the calling thread doesn't wake the background thread [ms] */
+        static const int pollInterval = 1;
+
+        /** Block size [samples] */
+        const int blockSize;
+
+        /** Offset of the impulse responses segment [samples] */
+        const int irOffset;
+
+        /** Convolution engine, processing one full block at a time */
+        UniformPartitionedConvolution convolution;
+
+        /** Input blocks */
+        AudioBuffer<float> inputBlocks[numSlots];
+
+        /** Output blocks */
+        AudioBuffer<float> outputBlocks[numSlots];
+
+        /** Slot of the output block being played, -1 to play silence. Calling thread only */
+        int playSlot = -1;
+
+        /** Number of blocks submitted by the audio thread */
+        std::atomic<int> numSubmitted;
+
+        /** Number of blocks completed by the background thread */
+        std::atomic<int> numCompleted;
+    };
+
+    /** Number of inputs */
+    int numInputs;
+
+    /** Number of outputs */
+    int numOutputs;
+
+    /** Maximum impulse responses length [samples] */
+    int irLen;
+
+    /** Head of the impulse responses */
+    std::unique_ptr<UniformPartitionedConvolution> head;
+
+    /** Tail stages, with increasing block size */
+    std::vector<std::unique_ptr<TailStage>> tail;
+
+    /** Position in the current block of each tail stage [samples] */
+    std::vector<int> tailDataPos;
+
+    /** Number of tail blocks not completed in time */
+    std::atomic<int64> numLateBlocks;
+
+    void render(const AudioBuffer<float> &in, AudioBuffer<float> &out, bool accumulate);
+
+};
@@ -9,6 +9,17 @@
 
 //==============================================================================
 // Helper functions
+
+/** Parameter showing a statistic to the host. Not automatable, only set by the processor */
+class StatisticParameter : public AudioParameterInt {
+public:
+    using AudioParameterInt::AudioParameterInt;
+    
+    bool isAutomatable() const override { return false; }
+    
+    Category getCategory() const override { return outputMeter; }
+};
+
 AudioProcessorValueTreeState::ParameterLayout initializeParameters() {
     
     std::vector<std::unique_ptr<RangedAudioParameter>> params;
@@ -60,6 +71,31 @@ AudioProcessorValueTreeState::ParameterLayout initializeParameters() {
         }
     }
     
+    // Added after the original parameters, so that hosts addressing them by index find them unchanged
+    params.push_back(std::make_unique<AudioParameterChoice>("rendering", //tag
+                                                            "Rendering", //name
+                                                            renderingModeLabels, //choices
+                                                            0 //default
+                                                            ));
+    
+    for (auto srcIdx = 0; srcIdx < NUM_SOURCES; ++srcIdx) {
+        params.push_back(std::make_unique<AudioParameterFloat>("width" + String(srcIdx + 1), //tag
+                                                               "Width " + String(srcIdx + 1), //name
+                                                               0.0f, //min
+                                                               1.0f, //max
+                                                               0 //default
+                                                               ));
+    }
+    
+    // Statistics, last so that the indices of the parameters above don't change
+    params.push_back(std::make_unique<StatisticParameter>("missedDeadlines", //tag
+                                                          "Missed deadlines", //name
+                                                          0, //min
+                                                          100000, //max
+                                                          0, //default
+                                                          "last min" //label
+                                                          ));
+    
     return {params.begin(), params.end()};
 }
 
@@ -72,19 +108,33 @@ EstickSimAudioProcessor::EstickSimAudioProcessor()
                  .withOutput("eStick#3", AudioChannelSet::ambisonic(3), true)
                  .withOutput("eStick#4", AudioChannelSet::ambisonic(3), true)
                  .withInput("Input", AudioChannelSet::stereo(), true)
-                 ), parameters(*this, nullptr, Identifier("eStickSimParams"), initializeParameters()) {
+                 ), resources(nullptr), resourcesInUse(nullptr), load(0),
+                 parameters(*this, nullptr, Identifier("eStickSimParams"), initializeParameters()) {
     
     /** Get parameters pointers */
     configParam = parameters.getRawParameterValue("config");
-    parameters.addParameterListener("config", this);
     hpfParam = parameters.getRawParameterValue("hpf");
+    renderingParam = parameters.getRawParameterValue("rendering");
     
     for (auto srcIdx = 0; srcIdx < NUM_SOURCES; srcIdx++) {
         steerXParam[srcIdx] = parameters.getRawParameterValue("steerX" + String(srcIdx + 1));
         steerYParam[srcIdx] = parameters.getRawParameterValue("steerY" + String(srcIdx + 1));
+        widthParam[srcIdx] = parameters.getRawParameterValue("width" + String(srcIdx + 1));
         levelParam[srcIdx] = parameters.getRawParameterValue("level" + String(srcIdx + 1));
         muteParam[srcIdx] = parameters.getRawParameterValue("mute" + String(srcIdx + 1));
     }
+    missedDeadlinesParam = dynamic_cast<AudioParameterInt *>(parameters.getParameter("missedDeadlines"));
+    startTimer(statisticsInterval);
+    
+    /** Replaced resources are freed in the background */
+    housekeeper = std::make_unique<Housekeeper>(resourcesInUse);
+    housekeeper->startThread(2);
+    
+    /** Timeline recording from the start, e.g. ESTICK_TRACE_FILE=/tmp/estick_trace.json */
+    const auto tracePath = SystemStats::getEnvironmentVariable("ESTICK_TRACE_FILE", {});
+    if (File::isAbsolutePath(tracePath)) {
+        startTrace(File(tracePath));
+    }
     
 }
 
@@ -115,133 +165,433 @@ bool EstickSimAudioProcessor::isBusesLayoutSupported(const BusesLayout &layouts)
 //==============================================================================
 void EstickSimAudioProcessor::prepareToPlay(double sampleRate_, int maximumExpectedSamplesPerBlock_) {
     
-    GenericScopedLock<SpinLock> lock(processingLock);
+    /** The new resources are allocated while the old ones, if any, keep playing */
+    auto res = std::make_unique<Resources>();
     
-    sampleRate = sampleRate_;
-    maximumExpectedSamplesPerBlock = maximumExpectedSamplesPerBlock_;
+    res->sampleRate = sampleRate_;
+    res->maximumExpectedSamplesPerBlock = maximumExpectedSamplesPerBlock_;
     
     /** Number of active input channels */
-    numActiveInputChannels = jmin(NUM_SOURCES,getTotalNumInputChannels());
-    
-    /** Number of active output channels */
-    numActiveOutputChannels = getTotalNumOutputChannels();
-    
+    res->numActiveInputChannels = jmin(NUM_SOURCES,getTotalNumInputChannels());
     
     /** Initialize the High Pass Filters */
-    iirHPFfilters.clear();
-    iirHPFfilters.resize(numActiveInputChannels);
-    prevHpfFreq = 0;
+    res->iirHPFfilters.resize(res->numActiveInputChannels);
+    res->prevHpfFreq = 0;
     
     /** Initialize the beamformer */
-    beamformer = std::make_unique<Beamformer>(NUM_SOURCES, static_cast<MicConfig>((int) *configParam),sampleRate, maximumExpectedSamplesPerBlock);
+    const int numWorkers = jlimit(0, maxNumWorkers, SystemStats::getNumCpus() - 2);
+    res->requestedConfig = static_cast<MicConfig>((int) *configParam);
+    res->beamformer = std::make_unique<Beamformer>(NUM_SOURCES, res->requestedConfig, res->sampleRate, 0,
+                                                   numWorkers, steeringTableSize);
+    res->beamformer->setProfiler(&profiler);
+    const int irVersion = impulseResponses.applyTo(*res->beamformer, res->maximumExpectedSamplesPerBlock);
+    
+    /** The beamformer runs on its own internal blocks, regardless of the host block size */
+    setLatencySamples(res->beamformer->getLatencySamples());
+    
+    /** Configuration changes are built in the background, with the same internal blocks, hence latency */
+    res->beamformerBuilder = std::make_unique<BeamformerBuilder>(res->requestedConfig, res->sampleRate,
+                                                                 res->beamformer->getBlockSize(), numWorkers,
+                                                                 &profiler, impulseResponses, irVersion,
+                                                                 res->maximumExpectedSamplesPerBlock,
+                                                                 steeringTableSize);
+    res->beamformerBuilder->startThread(3);
+    res->incomingBuffer.setSize(jmax(getTotalNumInputChannels(), getTotalNumOutputChannels()),
+                                res->maximumExpectedSamplesPerBlock);
     
     /** Initialize level gains */
     for (auto srcIdx = 0; srcIdx < NUM_SOURCES; ++srcIdx) {
-        sourceGain[srcIdx].reset();
-        sourceGain[srcIdx].prepare({sampleRate, static_cast<uint32>(maximumExpectedSamplesPerBlock), 1});
-        sourceGain[srcIdx].setGainDecibels(*levelParam[srcIdx]);
-        sourceGain[srcIdx].setRampDurationSeconds(gainTimeConst);
+        res->sourceGain[srcIdx].reset();
+        res->sourceGain[srcIdx].prepare({res->sampleRate, static_cast<uint32>(res->maximumExpectedSamplesPerBlock), 1});
+        res->sourceGain[srcIdx].setGainDecibels(*levelParam[srcIdx]);
+        res->sourceGain[srcIdx].setRampDurationSeconds(gainTimeConst);
+        res->silentSamples[srcIdx] = 0;
+        res->sourceActive[srcIdx] = true;
     }
     
-    resourcesAllocated = true;
-    
-    /** Time constants */
-    loadAlpha = 1 - exp(-(maximumExpectedSamplesPerBlock / sampleRate) / loadTimeConst);
-    
+    setResources(res.release());
 }
 
 void EstickSimAudioProcessor::releaseResources() {
+    setResources(nullptr);
     
-    GenericScopedLock<SpinLock> lock(processingLock);
-    
-    resourcesAllocated = false;
-    
-    /** Clear the HPF */
-    iirHPFfilters.clear();
+    /** Log the deadline misses and the quality reductions, if any */
+    if (deadlineMonitor.getStatistics().numMisses > 0) {
+        Logger::writeToLog(deadlineMonitor.getReport());
+    }
+    if (governor.getStatistics().numReductions > 0) {
+        Logger::writeToLog(governor.getReport());
+    }
     
-    /** Clear the Beamformer */
-    beamformer.reset();
+    /** Dump the stages timings when requested, e.g. ESTICK_PROFILER_REPORT=/tmp/estick_profile.txt */
+    const auto reportPath = SystemStats::getEnvironmentVariable("ESTICK_PROFILER_REPORT", {});
+    if (File::isAbsolutePath(reportPath)) {
+        File(reportPath).replaceWithText(profiler.getReport() + newLine + deadlineMonitor.getReport() + newLine +
+                                         governor.getReport());
+    }
+}
+
+void EstickSimAudioProcessor::timerCallback() {
+    /** Counts past the range are shown as the maximum */
+    const auto numMisses = deadlineMonitor.getStatistics().numMissesLastMinute;
+    *missedDeadlinesParam = (int) jmin<int64>(numMisses, missedDeadlinesParam->getRange().getEnd());
+}
+
+void EstickSimAudioProcessor::setResources(Resources *newResources) {
+    /** From now on the audio thread can only pick the new resources */
+    if (const auto oldResources = resources.exchange(newResources)) {
+        housekeeper->retire(oldResources);
+    }
 }
 
 
 void EstickSimAudioProcessor::processBlock(AudioBuffer<float> &buffer, MidiBuffer &midiMessages) {
     
-    const auto startTick = Time::getHighResolutionTicks();
-    
-    GenericScopedLock<SpinLock> lock(processingLock);
+    /** Announce the resources in use, then make sure they were not replaced in the meantime */
+    Resources *res;
+    do {
+        res = resources.load();
+        resourcesInUse = res;
+    } while (res != resources.load());
     
     /** If resources are not allocated this is an out-of-order request */
-    if (!resourcesAllocated) {
+    if (res == nullptr) {
         jassertfalse;
-        return;
+    } else {
+        /** Blocks larger than announced to prepareToPlay are processed in chunks the resources are sized for */
+        const int chunkSize = jmax(1, res->maximumExpectedSamplesPerBlock);
+        for (auto startSample = 0; startSample < buffer.getNumSamples(); startSample += chunkSize) {
+            process(*res, buffer, startSample, jmin(chunkSize, buffer.getNumSamples() - startSample));
+        }
     }
     
+    resourcesInUse = nullptr;
+}
+
+void EstickSimAudioProcessor::process(Resources &res, AudioBuffer<float> &buffer, int startSample, int numSamples) {
+    
+    /** Nothing to process, and no period to measure the load over */
+    if (numSamples == 0)
+        return;
+    
+    const auto startTick = Time::getHighResolutionTicks();
+    Profiler::ScopedTimer callbackTimer(&profiler, Profiler::callback);
+    auto &trace = profiler.getTraceRecorder();
+    
+    /** Nothing below may allocate or free memory. Checked when the allocation tripwire is enabled */
+    AllocationTripwire::ScopedArm noAllocations;
+    
     ScopedNoDenormals noDenormals;
     
     /** Renew IIR coefficient if cut frequency changed */
-    if (prevHpfFreq != (bool) *hpfParam) {
-        iirCoeffHPF = IIRCoefficients::makeHighPass(sampleRate, *hpfParam);
-        prevHpfFreq = *hpfParam;
-        for (auto &iirHPFfilter : iirHPFfilters) {
-            iirHPFfilter.setCoefficients(iirCoeffHPF);
+    if (res.prevHpfFreq != (bool) *hpfParam) {
+        res.iirCoeffHPF = IIRCoefficients::makeHighPass(res.sampleRate, *hpfParam);
+        res.prevHpfFreq = *hpfParam;
+        for (auto &iirHPFfilter : res.iirHPFfilters) {
+            iirHPFfilter.setCoefficients(res.iirCoeffHPF);
+        }
+    }
+    
+    /** Gate muted sources, and sources that stayed silent for longer than the hangover.
+     Gated sources are cleared, so that the beamformer can skip them */
+    const int hangoverSamples = roundToInt(silenceHangoverTime * res.sampleRate);
+    for (auto srcIdx = 0; srcIdx < NUM_SOURCES; srcIdx++) {
+        bool active = false;
+        if (srcIdx < res.numActiveInputChannels && !(bool)*muteParam[srcIdx]) {
+            if (buffer.getMagnitude(srcIdx, startSample, numSamples) > silenceThreshold) {
+                res.silentSamples[srcIdx] = 0;
+            } else {
+                res.silentSamples[srcIdx] = jmin(hangoverSamples, res.silentSamples[srcIdx] + numSamples);
+            }
+            active = res.silentSamples[srcIdx] < hangoverSamples;
+        }
+        if (active && !res.sourceActive[srcIdx]) {
+            /** The filters state is stale */
+            res.iirHPFfilters[srcIdx].reset();
+            res.sourceGain[srcIdx].reset();
+        }
+        res.sourceActive[srcIdx] = active;
+        if (!active && srcIdx < buffer.getNumChannels()) {
+            buffer.clear(srcIdx, startSample, numSamples);
         }
     }
     
     /**Apply input gain directly on input buffer  */
-    for (auto srcIdx = 0; srcIdx < numActiveInputChannels; srcIdx++){
-        if ((bool)*muteParam[srcIdx]){
-            buffer.clear(srcIdx, 0, buffer.getNumSamples());
-        }else{
-            sourceGain[srcIdx].setGainDecibels( *levelParam[srcIdx]);
-            auto block = juce::dsp::AudioBlock<float>(buffer).getSubsetChannelBlock(srcIdx, 1);
+    auto stageStartTick = Time::getHighResolutionTicks();
+    for (auto srcIdx = 0; srcIdx < res.numActiveInputChannels; srcIdx++){
+        if (res.sourceActive[srcIdx]){
+            res.sourceGain[srcIdx].setGainDecibels( *levelParam[srcIdx]);
+            auto block = juce::dsp::AudioBlock<float>(buffer).getSubBlock(startSample, numSamples)
+                                                             .getSubsetChannelBlock(srcIdx, 1);
             auto context = juce::dsp::ProcessContextReplacing<float>(block);
-            sourceGain[srcIdx].process(context);
+            res.sourceGain[srcIdx].process(context);
         }
     }
+    profiler.record(Profiler::sourceGain, stageStartTick, Time::getHighResolutionTicks());
     
     /**Apply HPF directly on input buffer  */
-    for (auto inChannel = 0; inChannel < numActiveInputChannels; ++inChannel) {
-        iirHPFfilters[inChannel].processSamples(buffer.getWritePointer(inChannel), buffer.getNumSamples());
+    stageStartTick = Time::getHighResolutionTicks();
+    for (auto inChannel = 0; inChannel < res.numActiveInputChannels; ++inChannel) {
+        if (res.sourceActive[inChannel]) {
+            res.iirHPFfilters[inChannel].processSamples(buffer.getWritePointer(inChannel, startSample), numSamples);
+        }
+    }
+    profiler.record(Profiler::highPassFilter, stageStartTick, Time::getHighResolutionTicks());
+    
+    /** The beamformer for a new configuration is built in the background, then faded in. While fading in it
+     doubles the processing, configuration changes wait for full quality */
+    const bool reducedQuality = governor.getQuality() == QualityGovernor::reduced;
+    const auto config = static_cast<MicConfig>((int) *configParam);
+    if (config != res.requestedConfig && !reducedQuality) {
+        res.beamformerBuilder->requestMicConfig(config);
+        res.requestedConfig = config;
+        trace.record(TraceRecorder::instant, "Config request", config);
     }
     
-    /** Set parameters */
-    for (auto srcIdx = 0; srcIdx < NUM_SOURCES; srcIdx++) {
-        float beamDoaX = -*steerXParam[srcIdx];
-        float beamDoaY = (*steerYParam[srcIdx]);
-        BeamParameters params = {beamDoaX,beamDoaY, 0};
-        beamformer->setParams(srcIdx, params);
+    /** Take the beamformer for a new configuration, if any. One at a time, the one it replaces must be retired */
+    if (res.incomingBeamformer == nullptr && res.retiringBeamformer == nullptr && !reducedQuality) {
+        res.incomingBeamformer = res.beamformerBuilder->takeBeamformer();
+        res.incomingSamples = 0;
+        res.incomingFadeSamples = -1;
+        if (res.incomingBeamformer != nullptr) {
+            trace.record(TraceRecorder::instant, "Config incoming", res.incomingBeamformer->getNumMic());
+        }
     }
     
-    /** Call the beamformer  */
-    beamformer->processBlock(buffer);
+    /** The incoming beamformer processes a copy of the sources, along the active one.
+     Its processing and the parameters updates are what reduced quality saves */
+    jassert(numSamples <= res.incomingBuffer.getNumSamples());
+    jassert(buffer.getNumChannels() <= res.incomingBuffer.getNumChannels());
+    int64 leverTicks = 0;
+    if (res.incomingBeamformer != nullptr) {
+        const auto incomingStartTick = Time::getHighResolutionTicks();
+        for (auto channel = 0; channel < buffer.getNumChannels(); channel++) {
+            res.incomingBuffer.copyFrom(channel, 0, buffer, channel, startSample, numSamples);
+        }
+        updateBeamformer(res, *res.incomingBeamformer);
+        res.incomingBeamformer->processBlock(res.incomingBuffer, 0, numSamples);
+        res.incomingSamples += numSamples;
+        leverTicks += Time::getHighResolutionTicks() - incomingStartTick;
+    }
     
-    /** Clear buffer */
-    buffer.clear();
+    /** Call the beamformer. Sources are replaced by the microphones signals */
+    const auto paramsStartTicks = profiler.getTotalTicks(Profiler::beamParameters);
+    updateBeamformer(res, *res.beamformer);
+    res.beamformer->processBlock(buffer, startSample, numSamples);
+    leverTicks += profiler.getTotalTicks(Profiler::beamParameters) - paramsStartTicks;
+    
+    /** Crossfade to the incoming beamformer once its output is complete */
+    if (res.incomingBeamformer != nullptr) {
+        if (res.incomingFadeSamples < 0 && (res.incomingBeamformer->isSettled() ||
+                                            res.incomingSamples >= maxConfigSettlingTime * res.sampleRate)) {
+            res.incomingFadeSamples = 0;
+            trace.record(TraceRecorder::instant, "Config crossfade", res.incomingSamples);
+        }
+        if (res.incomingFadeSamples >= 0) {
+            const int fadeLength = jmax(1, roundToInt(configCrossfadeTime * res.sampleRate));
+            const float startGain = float(res.incomingFadeSamples) / fadeLength;
+            res.incomingFadeSamples = jmin(fadeLength, res.incomingFadeSamples + numSamples);
+            const float endGain = float(res.incomingFadeSamples) / fadeLength;
+            for (auto channel = 0; channel < buffer.getNumChannels(); channel++) {
+                buffer.applyGainRamp(channel, startSample, numSamples, 1 - startGain, 1 - endGain);
+                buffer.addFromWithRamp(channel, startSample, res.incomingBuffer.getReadPointer(channel), numSamples,
+                                       startGain, endGain);
+            }
+            if (res.incomingFadeSamples == fadeLength) {
+                res.retiringBeamformer = std::move(res.beamformer);
+                res.beamformer = std::move(res.incomingBeamformer);
+                trace.record(TraceRecorder::instant, "Config switched");
+            }
+        }
+    }
     
-    /** Retrieve beamformer outputs */
-    beamformer->getOutput(buffer);
+    /** The replaced beamformer is deleted, or kept for reuse, by the builder */
+    if (res.retiringBeamformer != nullptr) {
+        res.beamformerBuilder->retireBeamformer(res.retiringBeamformer);
+    }
     
-    /** Update load */
+    /** Update load, over the period of the samples actually processed. Written by the audio thread only */
+    const auto endTick = Time::getHighResolutionTicks();
+    const double period = numSamples / res.sampleRate;
     {
-        const float elapsedTime = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - startTick);
-        const float curLoad = elapsedTime / (maximumExpectedSamplesPerBlock / sampleRate);
-        GenericScopedLock<SpinLock> lock(loadLock);
-        load = (load * (1 - loadAlpha)) + (curLoad * loadAlpha);
+        const float loadAlpha = 1 - exp(-period / loadTimeConst);
+        const float curLoad = Time::highResolutionTicksToSeconds(endTick - startTick) / period;
+        load.store((load.load() * (1 - loadAlpha)) + (curLoad * loadAlpha));
+        const float curLeverLoad = Time::highResolutionTicksToSeconds(leverTicks) / period;
+        res.leverLoad = (res.leverLoad * (1 - loadAlpha)) + (curLeverLoad * loadAlpha);
+    }
+    
+    /** Trade quality for processing time before the load reaches the deadline */
+    if (governor.update(load, res.leverLoad, period)) {
+        trace.record(TraceRecorder::instant, reducedQuality ? "Quality restored" : "Quality reduced",
+                     roundToInt(load * 100));
     }
     
+    /** Check the deadline against the actual duration of the block */
+    const auto outcome = deadlineMonitor.recordCallback(startTick, endTick, numSamples, res.sampleRate);
+    if (outcome != DeadlineMonitor::onTime) {
+        trace.record(TraceRecorder::instant, "Deadline miss", numSamples);
+    }
+    if (outcome == DeadlineMonitor::worstMiss) {
+        deadlineMonitor.recordScene(getScene(res));
+    }
+    
+}
+
+//==============================================================================
+DeadlineMonitor::Scene EstickSimAudioProcessor::getScene(const Resources &res) const {
+    DeadlineMonitor::Scene scene;
+    scene.config = static_cast<MicConfig>((int) *configParam);
+    scene.renderingMode = static_cast<RenderingMode>((int) *renderingParam);
+    scene.hpfFreq = *hpfParam;
+    scene.switchingConfig = res.incomingBeamformer != nullptr;
+    for (auto srcIdx = 0; srcIdx < NUM_SOURCES; srcIdx++) {
+        scene.beams[srcIdx] = {*steerXParam[srcIdx], *steerYParam[srcIdx], *widthParam[srcIdx]};
+        scene.levels[srcIdx] = *levelParam[srcIdx];
+        scene.muted[srcIdx] = (bool) *muteParam[srcIdx];
+        scene.active[srcIdx] = res.sourceActive[srcIdx];
+    }
+    return scene;
+}
+
+void EstickSimAudioProcessor::updateBeamformer(const Resources &res, Beamformer &bf) {
+    
+    /** Set rendering mode */
+    bf.setRenderingMode(static_cast<RenderingMode>((int) *renderingParam));
+    
+    /** At reduced quality the sources keep their current steering */
+    bf.setParamsFrozen(governor.getQuality() == QualityGovernor::reduced);
+    
+    /** Set parameters */
+    for (auto srcIdx = 0; srcIdx < NUM_SOURCES; srcIdx++) {
+        float beamDoaX = -*steerXParam[srcIdx];
+        float beamDoaY = (*steerYParam[srcIdx]);
+        float beamWidth = (*widthParam[srcIdx]);
+        BeamParameters params = {beamDoaX,beamDoaY, beamWidth};
+        bf.setParams(srcIdx, params);
+        bf.setSourceActive(srcIdx, res.sourceActive[srcIdx]);
+    }
+}
+
+//==============================================================================
+EstickSimAudioProcessor::Housekeeper::Housekeeper(const std::atomic<Resources *> &resourcesInUse_)
+        : Thread("Housekeeper"), resourcesInUse(resourcesInUse_) {
+}
+
+EstickSimAudioProcessor::Housekeeper::~Housekeeper() {
+    /** Freeing resources stops the beamformers threads, it takes a while */
+    stopThread(10000);
+}
+
+void EstickSimAudioProcessor::Housekeeper::run() {
+    while (!threadShouldExit()) {
+        
+        /** Move out the unused resources, then free them without holding the lock */
+        std::vector<std::unique_ptr<Resources>> unused;
+        bool anyInUse;
+        {
+            const ScopedLock lock(retiredLock);
+            for (auto &r : retired) {
+                if (r.get() != resourcesInUse.load()) {
+                    unused.push_back(std::move(r));
+                }
+            }
+            retired.erase(std::remove(retired.begin(), retired.end(), nullptr), retired.end());
+            anyInUse = !retired.empty();
+        }
+        unused.clear();
+        
+        /** Resources in use are freed as soon as the audio thread is done with the current block */
+        wait(anyInUse ? 10 : -1);
+    }
+}
+
+void EstickSimAudioProcessor::Housekeeper::retire(Resources *resources) {
+    {
+        const ScopedLock lock(retiredLock);
+        retired.emplace_back(resources);
+    }
+    notify();
 }
 
 //==============================================================================
+void EstickSimAudioProcessor::ImpulseResponseSet::set(int srcIdx, const AudioBuffer<float> &ir) {
+    jassert(srcIdx >= 0 && srcIdx < NUM_SOURCES);
+    const ScopedLock l(lock);
+    irs[srcIdx].makeCopyOf(ir);
+    version++;
+}
 
-void EstickSimAudioProcessor::parameterChanged(const String &parameterID, float newValue) {
-    if (parameterID == "config") {
-        setMicConfig(static_cast<MicConfig>((int) (newValue)));
+int EstickSimAudioProcessor::ImpulseResponseSet::applyTo(Beamformer &bf, int maxSamplesPerBlock) const {
+    const ScopedLock l(lock);
+    bf.setMaxSamplesPerBlock(maxSamplesPerBlock);
+    for (auto srcIdx = 0; srcIdx < NUM_SOURCES; srcIdx++) {
+        const auto &ir = irs[srcIdx];
+        if (ir.getNumSamples() > 0 && ir.getNumChannels() >= bf.getNumMic()) {
+            bf.setImpulseResponse(srcIdx, ir);
+        } else {
+            bf.clearImpulseResponse(srcIdx);
+        }
     }
+    return version;
 }
 
 //==============================================================================
-void EstickSimAudioProcessor::setMicConfig(const MicConfig &mc) {
-    prepareToPlay(sampleRate, maximumExpectedSamplesPerBlock);
+EstickSimAudioProcessor::BeamformerBuilder::BeamformerBuilder(MicConfig config, double sampleRate_, int blockSize_,
+                                                              int numWorkers_, Profiler *profiler_,
+                                                              const ImpulseResponseSet &irs_, int irVersion,
+                                                              int maxSamplesPerBlock_, size_t steeringTableSize_)
+        : Thread("Beamformer builder"), sampleRate(sampleRate_), blockSize(blockSize_), numWorkers(numWorkers_),
+          profiler(profiler_), irs(irs_), maxSamplesPerBlock(maxSamplesPerBlock_),
+          steeringTableSize(steeringTableSize_), requestedConfig(config),
+          builtConfig(config), builtIrVersion(irVersion), newBeamformer(nullptr), retiredBeamformer(nullptr) {
+}
+
+EstickSimAudioProcessor::BeamformerBuilder::~BeamformerBuilder() {
+    /** Building a beamformer takes a while */
+    stopThread(10000);
+    delete newBeamformer.exchange(nullptr);
+    delete retiredBeamformer.exchange(nullptr);
+}
+
+void EstickSimAudioProcessor::BeamformerBuilder::run() {
+    while (!threadShouldExit()) {
+        
+        /** Freed here, never on the audio thread */
+        delete retiredBeamformer.exchange(nullptr);
+        
+        /** One beamformer at a time, the next request is served once the audio thread took it */
+        const auto config = static_cast<MicConfig>(requestedConfig.load());
+        if ((config != builtConfig || irs.getVersion() != builtIrVersion) && newBeamformer.load() == nullptr) {
+            auto bf = std::make_unique<Beamformer>(NUM_SOURCES, config, sampleRate, blockSize, numWorkers,
+                                                   steeringTableSize);
+            bf->setProfiler(profiler);
+            builtIrVersion = irs.applyTo(*bf, maxSamplesPerBlock);
+            builtConfig = config;
+            newBeamformer = bf.release();
+            continue;
+        }
+        
+        wait(pollInterval);
+    }
+}
+
+void EstickSimAudioProcessor::BeamformerBuilder::requestMicConfig(MicConfig config) {
+    requestedConfig = config;
+}
+
+std::unique_ptr<Beamformer> EstickSimAudioProcessor::BeamformerBuilder::takeBeamformer() {
+    if (newBeamformer.load() == nullptr)
+        return nullptr;
+    return std::unique_ptr<Beamformer>(newBeamformer.exchange(nullptr));
+}
+
+bool EstickSimAudioProcessor::BeamformerBuilder::retireBeamformer(std::unique_ptr<Beamformer> &bf) {
+    Beamformer *expected = nullptr;
+    if (!retiredBeamformer.compare_exchange_strong(expected, bf.get()))
+        return false;
+    bf.release();
+    return true;
 }
 
 //==============================================================================
@@ -276,6 +626,11 @@ void EstickSimAudioProcessor::setStateInformation(const void *data, int sizeInBy
 //==============================================================================
 // Unchanged JUCE default functions
 EstickSimAudioProcessor::~EstickSimAudioProcessor() {
+    stopTimer();
+    
+    /** The housekeeper frees all the resources when stopped */
+    setResources(nullptr);
+    housekeeper.reset();
 }
 
 const String EstickSimAudioProcessor::getName() const {
@@ -9,12 +9,14 @@
 
 #include "../JuceLibraryCode/JuceHeader.h"
 #include "Beamformer.h"
+#include "AllocationTripwire.h"
+#include "Profiler.h"
+#include "DeadlineMonitor.h"
+#include "QualityGovernor.h"
 
 //==============================================================================
 
-class EstickSimAudioProcessor :
-public AudioProcessor,
-public AudioProcessorValueTreeState::Listener {
+class EstickSimAudioProcessor : public AudioProcessor, private Timer {
 public:
     
     //==============================================================================
@@ -60,64 +62,301 @@ public:
     
     void setStateInformation(const void *data, int sizeInBytes) override;
     
+    //==============================================================================
+    // Diagnostics
+    
+    /** Get the timings of the processing stages. Any thread */
+    const Profiler &getProfiler() const { return profiler; }
+    
+    /** Get the measured average load, as a fraction of the block duration. Any thread */
+    float getLoad() const { return load; }
+    
+    /** Start recording a timeline of the processing to a Chrome trace file. Not from the audio thread
+     
+     Also started at construction when ESTICK_TRACE_FILE is set to an absolute path.
+     @return false if already recording or if the file can't be written
+     */
+    bool startTrace(const File &file) { return profiler.getTraceRecorder().startRecording(file); }
+    
+    /** Stop recording the timeline and complete the file. Not from the audio thread */
+    void stopTrace() { profiler.getTraceRecorder().stopRecording(); }
+    
+    /** Get the callbacks deadline statistics, and set the deadline. Not from the audio thread
+     
+     For code built with the processor, e.g. the tests. Hosts see the misses of the last minute as the read-only
+     missedDeadlines parameter, and the full report in the log when the resources are released.
+     */
+    DeadlineMonitor &getDeadlineMonitor() { return deadlineMonitor; }
+    
+    /** Get the quality level chosen from the load, and its statistics. Any thread */
+    const QualityGovernor &getQualityGovernor() const { return governor; }
+    
+    //==============================================================================
+    // Impulse responses
+    
+    /** Render a source through a set of impulse responses, e.g. measured in a room, instead of the beamforming FIRs.
+     Not from the audio thread
+     
+     A beamformer with the new impulse responses is built in the background, then faded in as for a configuration
+     change. Configurations with more microphones than the channels of ir keep the beamforming FIRs.
+     @param ir: impulse responses, one channel per microphone
+     */
+    void setImpulseResponse(int srcIdx, const AudioBuffer<float> &ir) { impulseResponses.set(srcIdx, ir); }
+    
+    /** Go back to the beamforming FIRs for a source. Not from the audio thread */
+    void clearImpulseResponse(int srcIdx) { impulseResponses.set(srcIdx, {}); }
+    
+    //==============================================================================
+    // Memory
+    
+    /** Set the memory budget for the steering table of the FIR designer [bytes]. Not from the audio thread
+     
+     Finer tables give FIRs closer to the ones designed from scratch, 0 designs each FIR from scratch. Applied to the
+     beamformers built from the next prepareToPlay on. Beamformers with the same configuration, sample rate and
+     budget share a single table, across processor instances too.
+     */
+    void setSteeringTableSize(size_t bytes) { steeringTableSize = bytes; }
+    
 private:
     //==============================================================================
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (EstickSimAudioProcessor)
     
     //==============================================================================
-    /** Number of active input channels */
-    juce::uint32 numActiveInputChannels = 0;
-    /** Number of active output channels */
-    juce::uint32 numActiveOutputChannels = 0;
+    /** Maximum number of worker threads helping the audio thread with the convolution. One core is left to the host */
+    const int maxNumWorkers = 2;
     
-    //==============================================================================
     /** Time Constant for input gain variations */
     const float gainTimeConst = 0.1;
-    /** Beam gain for each beam */
-    dsp::Gain<float> sourceGain[NUM_SOURCES];
     
-    //==============================================================================
-    /** Previous HPF cut frequency */
-    float prevHpfFreq = 0;
-    /** Coefficients of the IIR HPF */
-    IIRCoefficients iirCoeffHPF;
-    /** IIR HPF */
-    std::vector<IIRFilter> iirHPFfilters;
+    /** Sources whose peak stays below this level are considered silent, about -90dBFS */
+    const float silenceThreshold = 3e-5;
+    /** Time a source must stay silent before being gated [s] */
+    const float silenceHangoverTime = 0.5;
+    
+    /** Crossfade time between beamformers, when the configuration changes [s] */
+    const float configCrossfadeTime = 0.05;
+    
+    /** Longest time an incoming beamformer waits to settle before fading in [s] */
+    const float maxConfigSettlingTime = 0.5;
+    
+    /** Load time constant [s] */
+    const float loadTimeConst = 1;
+    
+    /** Refresh interval of the statistics shown to the host [ms] */
+    const int statisticsInterval = 1000;
     
     //==============================================================================
-    /** The active beamformer */
-    std::unique_ptr<Beamformer> beamformer;
+    /** Impulse responses of the sources, set on every beamformer built */
+    class ImpulseResponseSet {
+    public:
+        ImpulseResponseSet() : version(0) {}
+        
+        /** Set the impulse responses of a source, empty for the beamforming FIRs. Not from the audio thread */
+        void set(int srcIdx, const AudioBuffer<float> &ir);
+        
+        /** Set the impulse responses on a beamformer that is not being processed. Not from the audio thread
+         
+         @param maxSamplesPerBlock: largest number of samples given to processBlock
+         @return the version applied
+         */
+        int applyTo(Beamformer &bf, int maxSamplesPerBlock) const;
+        
+        /** Incremented at every change. Any thread */
+        int getVersion() const { return version; }
+        
+    private:
+        /** Guarded by lock */
+        AudioBuffer<float> irs[NUM_SOURCES];
+        CriticalSection lock;
+        std::atomic<int> version;
+    };
+    
+    /** Impulse responses of the sources */
+    ImpulseResponseSet impulseResponses;
+    
+    /** Memory budget for the steering table of the beamformers [bytes] */
+    std::atomic<size_t> steeringTableSize{Beamformer::defaultSteeringTableSize};
     
     //==============================================================================
-    /** Lock to prevent releaseResources being called when processBlock is running. AudioPluginHost does it. */
-    SpinLock processingLock;
+    /** Builds the beamformers for new microphone configurations and impulse responses on a background thread
+     
+     The audio thread takes each new beamformer when it's ready, and hands back the one it replaced, through two
+     atomic pointers. Replaced beamformers are deleted here.
+     */
+    class BeamformerBuilder : public Thread {
+    public:
+        /** @param blockSize: internal block size of the beamformers, the same as the one in use
+            @param profiler: destination of the timings of the beamformers built
+            @param irs: impulse responses set on the beamformers built, a new beamformer is built when they change
+            @param irVersion: version of the impulse responses of the beamformer in use
+            @param maxSamplesPerBlock: largest number of samples given to processBlock
+            @param steeringTableSize: memory budget for the steering table of the beamformers built [bytes] */
+        BeamformerBuilder(MicConfig config, double sampleRate, int blockSize, int numWorkers, Profiler *profiler,
+                          const ImpulseResponseSet &irs, int irVersion, int maxSamplesPerBlock,
+                          size_t steeringTableSize);
+        
+        ~BeamformerBuilder();
+        
+        void run() override;
+        
+        /** Ask for a beamformer for a new microphone configuration. Any thread */
+        void requestMicConfig(MicConfig config);
+        
+        /** Take the latest beamformer built, if any. Audio thread */
+        std::unique_ptr<Beamformer> takeBeamformer();
+        
+        /** Hand over a replaced beamformer. Audio thread
+         
+         @return false if the previous one is yet to be collected, bf is left untouched
+         */
+        bool retireBeamformer(std::unique_ptr<Beamformer> &bf);
+        
+    private:
+        double sampleRate;
+        int blockSize;
+        int numWorkers;
+        Profiler *profiler;
+        const ImpulseResponseSet &irs;
+        int maxSamplesPerBlock;
+        size_t steeringTableSize;
+        
+        /** Requests and impulse responses changes are polled for, the audio thread doesn't wake the builder [ms] */
+        const int pollInterval = 10;
+        
+        /** Latest requested configuration */
+        std::atomic<int> requestedConfig;
+        
+        /** Configuration and impulse responses version of the latest beamformer built */
+        MicConfig builtConfig;
+        int builtIrVersion;
+        
+        /** Built beamformer, waiting for the audio thread. nullptr if none */
+        std::atomic<Beamformer *> newBeamformer;
+        
+        /** Replaced beamformer, waiting to be collected. nullptr if none */
+        std::atomic<Beamformer *> retiredBeamformer;
+    };
     
-    /** Resources for runtime are allocated.
+    //==============================================================================
+    /** Runtime resources, allocated by prepareToPlay and freed by releaseResources */
+    struct Resources {
+        /** Sample rate [Hz] */
+        float sampleRate = 48000;
+        /** Maximum number of samples per block */
+        int maximumExpectedSamplesPerBlock = 4096;
+        
+        /** Number of active input channels */
+        juce::uint32 numActiveInputChannels = 0;
+        
+        /** Beam gain for each beam */
+        dsp::Gain<float> sourceGain[NUM_SOURCES];
+        
+        /** Number of samples each source has been silent for, up to the hangover */
+        int silentSamples[NUM_SOURCES];
+        /** Whether each source is processed. Muted and silent sources are gated */
+        bool sourceActive[NUM_SOURCES];
+        
+        /** Previous HPF cut frequency */
+        float prevHpfFreq = 0;
+        /** Coefficients of the IIR HPF */
+        IIRCoefficients iirCoeffHPF;
+        /** IIR HPF */
+        std::vector<IIRFilter> iirHPFfilters;
+        
+        /** The active beamformer */
+        std::unique_ptr<Beamformer> beamformer;
+        
+        /** Configuration last requested to the builder */
+        MicConfig requestedConfig;
+        
+        /** Beamformers builder for the configuration changes */
+        std::unique_ptr<BeamformerBuilder> beamformerBuilder;
+        
+        /** Beamformer for the new configuration, running along the active one until it fades in. nullptr if none */
+        std::unique_ptr<Beamformer> incomingBeamformer;
+        
+        /** Beamformer replaced by the incoming one, to be handed over to the builder */
+        std::unique_ptr<Beamformer> retiringBeamformer;
+        
+        /** Inputs, then outputs, of the incoming beamformer. Sized for maximumExpectedSamplesPerBlock, only the
+         first samples of a shorter block are used */
+        AudioBuffer<float> incomingBuffer;
+        
+        /** Samples processed by the incoming beamformer */
+        int incomingSamples = 0;
+        
+        /** Samples into the crossfade to the incoming beamformer, -1 until it starts */
+        int incomingFadeSamples = -1;
+        
+        /** Time spent on parameters updates and on the incoming beamformer over the callback period, smoothed as
+         the load. Audio thread only */
+        float leverLoad = 0;
+    };
+    
+    /** Frees replaced resources on a background thread, once the audio thread is done with them
      
-     This flag is used to compensate for out-of-order calls to prepareToPlay, processBlock and releaseResources
+     The audio thread never waits: it announces the resources it's about to use in resourcesInUse, then checks that
+     they are still the current ones. Resources replaced by prepareToPlay or releaseResources are freed as soon as
+     they are not announced anymore.
      */
-    bool resourcesAllocated = false;
+    class Housekeeper : public Thread {
+    public:
+        Housekeeper(const std::atomic<Resources *> &resourcesInUse);
+        
+        ~Housekeeper();
+        
+        void run() override;
+        
+        /** Free replaced resources when unused. Not from the audio thread */
+        void retire(Resources *resources);
+        
+    private:
+        const std::atomic<Resources *> &resourcesInUse;
+        
+        /** Replaced resources, not freed yet. Guarded by retiredLock */
+        std::vector<std::unique_ptr<Resources>> retired;
+        CriticalSection retiredLock;
+    };
+    
+    /** Current resources. nullptr if not allocated.
+     
+     Also compensates for out-of-order calls to prepareToPlay, processBlock and releaseResources, AudioPluginHost
+     releases the resources while processBlock is running.
+     */
+    std::atomic<Resources *> resources;
     
-    /** Sample rate [Hz] */
-    float sampleRate = 48000;
+    /** Resources being used by the audio thread. nullptr if none */
+    std::atomic<Resources *> resourcesInUse;
     
-    /** Maximum number of samples per block */
-    int maximumExpectedSamplesPerBlock = 4096;
+    /** Frees the replaced resources */
+    std::unique_ptr<Housekeeper> housekeeper;
     
-    //==============================================================================
-    /** Set a new microphone configuration */
-    void setMicConfig(const MicConfig &mc);
+    /** Replace the current resources, the old ones are freed by the housekeeper */
+    void setResources(Resources *newResources);
+    
+    /** Process numSamples samples of buffer from startSample with the given resources.
+     numSamples must not exceed the maximumExpectedSamplesPerBlock the resources were prepared for */
+    void process(Resources &res, AudioBuffer<float> &buffer, int startSample, int numSamples);
+    
+    /** Set rendering mode, parameters and active sources of a beamformer */
+    void updateBeamformer(const Resources &res, Beamformer &bf);
+    
+    /** Get the current processing settings */
+    DeadlineMonitor::Scene getScene(const Resources &res) const;
     
     //==============================================================================
     
     /** Measured average load */
-    float load = 0;
-    /** Load time constant [s] */
-    const float loadTimeConst = 1;
-    /** Load update factor (the higher the faster the update) */
-    float loadAlpha = 1;
-    /** Load lock */
-    SpinLock loadLock;
+    std::atomic<float> load;
+    
+    /** Timings of the processing stages, since construction */
+    Profiler profiler;
+    
+    /** Callbacks that took too long, since construction */
+    DeadlineMonitor deadlineMonitor;
+    
+    /** Reduces quality when the load gets close to the deadline */
+    QualityGovernor governor;
     
     //==============================================================================
     
@@ -128,11 +367,17 @@ private:
     // VST parameters
     std::atomic<float> *steerXParam[NUM_SOURCES];
     std::atomic<float> *steerYParam[NUM_SOURCES];
+    std::atomic<float> *widthParam[NUM_SOURCES];
     std::atomic<float> *levelParam[NUM_SOURCES];
     std::atomic<float> *muteParam[NUM_SOURCES];
     std::atomic<float> *hpfParam;
     std::atomic<float> *configParam;
+    std::atomic<float> *renderingParam;
+    
+    /** Read-only parameters, set by the processor */
+    AudioParameterInt *missedDeadlinesParam;
     
-    void parameterChanged(const String &parameterID, float newValue) override;
+    /** Show the latest statistics to the host. Message thread */
+    void timerCallback() override;
     
 };
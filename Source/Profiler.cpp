@@ -0,0 +1,151 @@
+/*
+ Processing stages profiler
+
+ Authors:
+ Luca Bondi (luca.bondi@polimi.it)
+*/
+
+#include "Profiler.h"
+
+// ==============================================================================
+Profiler::ScopedTimer::ScopedTimer(Profiler *profiler_, Stage stage_)
+        : profiler(profiler_), stage(stage_), startTicks(profiler_ != nullptr ? Time::getHighResolutionTicks() : 0) {
+    if (profiler != nullptr) {
+        profiler->trace.record(TraceRecorder::begin, getStageName(stage), startTicks);
+    }
+}
+
+Profiler::ScopedTimer::~ScopedTimer() {
+    if (profiler != nullptr) {
+        const auto endTicks = Time::getHighResolutionTicks();
+        profiler->record(stage, endTicks - startTicks);
+        profiler->trace.record(TraceRecorder::end, getStageName(stage), endTicks);
+    }
+}
+
+// ==============================================================================
+Profiler::Profiler() {
+    secondsPerTick = 1. / Time::getHighResolutionTicksPerSecond();
+    for (auto &histogram : histograms) {
+        for (auto &count : histogram.counts) {
+            count = 0;
+        }
+        histogram.numEvents = 0;
+        histogram.totalTicks = 0;
+        histogram.maxTicks = 0;
+    }
+}
+
+void Profiler::record(Stage stage, int64 ticks) {
+    auto &histogram = histograms[stage];
+
+    const double time = jmax(minTime, ticks * secondsPerTick);
+    const int binIdx = jmin(numBins - 1, (int) (std::log2(time / minTime) * numBinsPerOctave));
+    histogram.counts[binIdx].fetch_add(1, std::memory_order_relaxed);
+    histogram.numEvents.fetch_add(1, std::memory_order_relaxed);
+    histogram.totalTicks.fetch_add(ticks, std::memory_order_relaxed);
+
+    /** Several threads may record the same stage */
+    auto maxTicks = histogram.maxTicks.load(std::memory_order_relaxed);
+    while (ticks > maxTicks && !histogram.maxTicks.compare_exchange_weak(maxTicks, ticks, std::memory_order_relaxed)) {
+    }
+}
+
+void Profiler::record(Stage stage, int64 startTicks, int64 endTicks) {
+    record(stage, endTicks - startTicks);
+    if (trace.isRecording()) {
+        trace.record(TraceRecorder::begin, getStageName(stage), startTicks);
+        trace.record(TraceRecorder::end, getStageName(stage), endTicks);
+    }
+}
+
+double Profiler::getBinTime(int binIdx) {
+    return minTime * std::exp2((binIdx + 0.5) / numBinsPerOctave);
+}
+
+double Profiler::getPercentile(const uint32 *counts, double fraction) {
+    int64 numEvents = 0;
+    for (auto binIdx = 0; binIdx < numBins; binIdx++) {
+        numEvents += counts[binIdx];
+    }
+    const double threshold = fraction * numEvents;
+    int64 cumulative = 0;
+    for (auto binIdx = 0; binIdx < numBins; binIdx++) {
+        cumulative += counts[binIdx];
+        if (cumulative > 0 && cumulative >= threshold) {
+            return getBinTime(binIdx);
+        }
+    }
+    return 0;
+}
+
+int64 Profiler::getTotalTicks(Stage stage) const {
+    return histograms[stage].totalTicks.load(std::memory_order_relaxed);
+}
+
+Profiler::Statistics Profiler::getStatistics(Stage stage) const {
+    const auto &histogram = histograms[stage];
+
+    /** The counters are read one by one while being updated, the snapshot is consistent within a few events */
+    uint32 counts[numBins];
+    for (auto binIdx = 0; binIdx < numBins; binIdx++) {
+        counts[binIdx] = histogram.counts[binIdx].load(std::memory_order_relaxed);
+    }
+
+    Statistics stats;
+    stats.numEvents = histogram.numEvents.load(std::memory_order_relaxed);
+    stats.mean = stats.numEvents > 0 ? histogram.totalTicks.load(std::memory_order_relaxed) * secondsPerTick /
+                                       stats.numEvents : 0;
+    stats.p50 = getPercentile(counts, 0.5);
+    stats.p99 = getPercentile(counts, 0.99);
+    stats.max = histogram.maxTicks.load(std::memory_order_relaxed) * secondsPerTick;
+    return stats;
+}
+
+const char *Profiler::getStageName(Stage stage) {
+    switch (stage) {
+        case sourceGain:
+            return "Source gain";
+        case highPassFilter:
+            return "High-pass filter";
+        case beamParameters:
+            return "Beam parameters";
+        case firDesign:
+            return "FIR design";
+        case inputFft:
+            return "Input FFT";
+        case multiplyAccumulate:
+            return "Multiply-accumulate";
+        case inverseFft:
+            return "Inverse FFT and output";
+        case delayRendering:
+            return "Delay rendering";
+        case fifoCopy:
+            return "FIFO copy";
+        case callback:
+            return "Callback";
+        case numStages:
+            break;
+    }
+    return "";
+}
+
+String Profiler::getReport() const {
+    String report;
+    report << String("Stage").paddedRight(' ', 24) << String("events").paddedLeft(' ', 12)
+           << String("mean [us]").paddedLeft(' ', 12) << String("p50 [us]").paddedLeft(' ', 12)
+           << String("p99 [us]").paddedLeft(' ', 12) << String("max [us]").paddedLeft(' ', 12) << newLine;
+    for (auto stageIdx = 0; stageIdx < numStages; stageIdx++) {
+        const auto stage = static_cast<Stage>(stageIdx);
+        const auto stats = getStatistics(stage);
+        report << String(getStageName(stage)).paddedRight(' ', 24) << String(stats.numEvents).paddedLeft(' ', 12)
+               << String(stats.mean * 1e6, 1).paddedLeft(' ', 12) << String(stats.p50 * 1e6, 1).paddedLeft(' ', 12)
+               << String(stats.p99 * 1e6, 1).paddedLeft(' ', 12) << String(stats.max * 1e6, 1).paddedLeft(' ', 12)
+               << newLine;
+    }
+    return report;
+}
+
+bool Profiler::writeReport(const File &file) const {
+    return file.replaceWithText(getReport());
+}
@@ -0,0 +1,137 @@
+/*
+ Processing stages profiler
+
+ Authors:
+ Luca Bondi (luca.bondi@polimi.it)
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "TraceRecorder.h"
+
+/** Timings of the processing stages, one histogram per stage
+
+ Durations are recorded by the audio thread, the workers and the FIR designer, with no locks and no allocations:
+ each histogram is a set of atomic counters over logarithmically spaced bins, so that statistics can be read from
+ any thread while recording goes on. Percentiles are accurate within the bin width, about 19%.
+ Timed stages are also marked on the timeline of the trace recorder, while it's recording.
+ */
+class Profiler {
+
+public:
+
+    /** Processing stages */
+    enum Stage {
+        /** Level of the sources */
+        sourceGain,
+        /** High-pass filter of the sources */
+        highPassFilter,
+        /** Parameters update of all the sources: delays and gains, FIRs requests and handover */
+        beamParameters,
+        /** FIR design for a source, on the background thread */
+        firDesign,
+        /** Spectrum of the input window of the convolution */
+        inputFft,
+        /** Frequency-domain multiply-accumulate of the convolution, summed over the workers */
+        multiplyAccumulate,
+        /** Inverse FFT, crossfade and overlap-save output of the convolution, summed over the workers */
+        inverseFft,
+        /** Fractional and variable delay renderers */
+        delayRendering,
+        /** Sources to the input FIFO, microphones from the output FIFO */
+        fifoCopy,
+        /** Whole processBlock */
+        callback,
+        numStages
+    };
+
+    /** Times a scope and records its duration and its trace events. No-op with a nullptr profiler */
+    class ScopedTimer {
+    public:
+        ScopedTimer(Profiler *profiler, Stage stage);
+
+        ~ScopedTimer();
+
+    private:
+        Profiler *profiler;
+        Stage stage;
+        int64 startTicks;
+
+        JUCE_DECLARE_NON_COPYABLE(ScopedTimer)
+    };
+
+    /** Statistics of a stage [s] */
+    struct Statistics {
+        int64 numEvents;
+        double mean;
+        double p50;
+        double p99;
+        double max;
+    };
+
+    Profiler();
+
+    /** Record a duration. Any thread, real-time safe
+
+     @param ticks: duration [high resolution ticks]
+     */
+    void record(Stage stage, int64 ticks);
+
+    /** Record a duration and its begin and end trace events. Any thread, real-time safe
+
+     @param startTicks: start time [high resolution ticks]
+     @param endTicks: end time [high resolution ticks]
+     */
+    void record(Stage stage, int64 startTicks, int64 endTicks);
+
+    /** Get the statistics of a stage since construction. Any thread */
+    Statistics getStatistics(Stage stage) const;
+
+    /** Get the total duration of a stage since construction, e.g. to measure it within a scope. Any thread,
+     real-time safe [high resolution ticks] */
+    int64 getTotalTicks(Stage stage) const;
+
+    /** Get the name of a stage */
+    static const char *getStageName(Stage stage);
+
+    /** Get a table of the statistics of all the stages, one line per stage */
+    String getReport() const;
+
+    /** Write the report to a file, replacing it. Return true on success */
+    bool writeReport(const File &file) const;
+
+    /** Get the timeline recorder, for the stages and for any other event */
+    TraceRecorder &getTraceRecorder() { return trace; }
+
+private:
+
+    /** Shortest duration with its own bin [s] */
+    static constexpr double minTime = 1e-7;
+    /** Bins per doubling of the duration */
+    static const int numBinsPerOctave = 4;
+    /** Number of bins, up to about 1.6 s. Longer durations go in the last bin */
+    static const int numBins = 24 * numBinsPerOctave;
+
+    struct Histogram {
+        std::atomic<uint32> counts[numBins];
+        std::atomic<int64> numEvents;
+        std::atomic<int64> totalTicks;
+        std::atomic<int64> maxTicks;
+    };
+
+    Histogram histograms[numStages];
+
+    TraceRecorder trace;
+
+    /** Duration of a tick [s] */
+    double secondsPerTick;
+
+    /** Duration at the center of a bin, on a logarithmic scale [s] */
+    static double getBinTime(int binIdx);
+
+    /** Duration with a fraction of the events at or below it, from a snapshot of the bins [s] */
+    static double getPercentile(const uint32 *counts, double fraction);
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (Profiler)
+};
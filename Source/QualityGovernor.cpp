@@ -0,0 +1,58 @@
+/*
+ Load-adaptive quality governor
+
+ Authors:
+ Luca Bondi (luca.bondi@polimi.it)
+*/
+
+#include "QualityGovernor.h"
+
+QualityGovernor::QualityGovernor() : quality(full), numReductions(0), timeReduced(0), holdTime(minHoldTime) {
+    timeSinceRestore = maxHoldTime;
+}
+
+bool QualityGovernor::update(float load, float leverLoad, double elapsedTime) {
+    if (getQuality() == full) {
+        timeSinceRestore += elapsedTime;
+        if (load <= degradeLoad || leverLoad < minLeverLoad || timeSinceRestore < minFullTime) {
+            return false;
+        }
+        /** Back to reduced quality soon after a restore, the load only fits at reduced quality */
+        const double hold = holdTime.load(std::memory_order_relaxed);
+        holdTime.store(timeSinceRestore < minFullTime + 2 * hold ? jmin(maxHoldTime, 2 * hold) : minHoldTime,
+                       std::memory_order_relaxed);
+        timeBelowRestore = 0;
+        timeSinceReduction = 0;
+        numReductions.fetch_add(1, std::memory_order_relaxed);
+        quality.store(reduced, std::memory_order_relaxed);
+        return true;
+    }
+
+    timeReduced.store(timeReduced.load(std::memory_order_relaxed) + elapsedTime, std::memory_order_relaxed);
+    timeBelowRestore = load < restoreLoad ? timeBelowRestore + elapsedTime : 0;
+    timeSinceReduction += elapsedTime;
+    if (timeBelowRestore < holdTime.load(std::memory_order_relaxed) && timeSinceReduction < maxReducedTime) {
+        return false;
+    }
+    timeSinceRestore = 0;
+    quality.store(full, std::memory_order_relaxed);
+    return true;
+}
+
+QualityGovernor::Statistics QualityGovernor::getStatistics() const {
+    Statistics stats;
+    stats.quality = getQuality();
+    stats.numReductions = numReductions.load(std::memory_order_relaxed);
+    stats.timeReduced = timeReduced.load(std::memory_order_relaxed);
+    stats.holdTime = holdTime.load(std::memory_order_relaxed);
+    return stats;
+}
+
+String QualityGovernor::getReport() const {
+    const auto stats = getStatistics();
+    String report;
+    report << "Quality " << (stats.quality == full ? "full" : "reduced") << ", reduced "
+           << String(stats.numReductions) << " times for " << String(stats.timeReduced, 1)
+           << " s in total. Hold time " << String(stats.holdTime, 0) << " s" << newLine;
+    return report;
+}
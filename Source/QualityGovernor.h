@@ -0,0 +1,96 @@
+/*
+ Load-adaptive quality governor
+
+ Authors:
+ Luca Bondi (luca.bondi@polimi.it)
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+/** Decides when to trade quality for processing time, from the smoothed load of the processor
+
+ Quality is reduced when the load goes above degradeLoad, but only if the work that reduced quality saves, i.e.
+ parameters updates and configuration crossfades, takes at least minLeverLoad: a load made of convolution alone
+ doesn't get any lower by freezing the automation.
+ Quality is restored once the load stays below restoreLoad for the hold time, and anyway after maxReducedTime, so
+ that automation and configuration changes are never held back for longer. It then stays full for at least
+ minFullTime, so that the changes held back are applied. The hold time doubles every time quality has to be reduced
+ again shortly after a restore, so that a load that only fits at reduced quality doesn't oscillate as fast.
+
+ Updated by the audio thread without locks or allocations, the state can be read from any thread.
+ */
+class QualityGovernor {
+
+public:
+
+    /** Quality levels */
+    enum Quality {
+        /** Everything as requested */
+        full,
+        /** Beam parameters frozen and microphone configuration changes deferred, for at most maxReducedTime */
+        reduced
+    };
+
+    struct Statistics {
+        Quality quality;
+        /** Number of times quality was reduced */
+        int64 numReductions;
+        /** Time spent at reduced quality [s] */
+        double timeReduced;
+        /** Current hold time before restoring quality [s] */
+        double holdTime;
+    };
+
+    QualityGovernor();
+
+    /** Update with the smoothed load of the last callback. Audio thread
+
+     @param load: processing time over the callback period, smoothed
+     @param leverLoad: time spent on parameters updates and configuration crossfades over the callback period,
+                       smoothed. The part of the load that reduced quality can save
+     @param elapsedTime: duration of the callback [s]
+     @return true if quality changed
+     */
+    bool update(float load, float leverLoad, double elapsedTime);
+
+    /** Get the current quality. Any thread */
+    Quality getQuality() const { return quality.load(std::memory_order_relaxed); }
+
+    /** Get the state and the counters since construction. Any thread */
+    Statistics getStatistics() const;
+
+    /** Get a summary of the statistics */
+    String getReport() const;
+
+private:
+
+    /** Load above which quality is reduced */
+    const float degradeLoad = 0.85;
+    /** Load below which quality is restored, after the hold time */
+    const float restoreLoad = 0.6;
+    /** Smallest share of the load that reduced quality must be able to save */
+    const float minLeverLoad = 0.1;
+    /** Shortest and longest hold time [s] */
+    const double minHoldTime = 1;
+    const double maxHoldTime = 4;
+    /** Longest time at reduced quality [s] */
+    const double maxReducedTime = 8;
+    /** Shortest time at full quality after a restore [s] */
+    const double minFullTime = 2;
+
+    std::atomic<Quality> quality;
+    std::atomic<int64> numReductions;
+    std::atomic<double> timeReduced;
+    std::atomic<double> holdTime;
+
+    /** Time spent below restoreLoad at reduced quality [s]. Audio thread only */
+    double timeBelowRestore = 0;
+    /** Time since quality was last reduced [s]. Audio thread only */
+    double timeSinceReduction = 0;
+    /** Time since quality was last restored [s]. Audio thread only */
+    double timeSinceRestore = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (QualityGovernor)
+};
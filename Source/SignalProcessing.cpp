@@ -26,33 +26,71 @@ void designTukeyWindow(Vec &win, size_t winLen, size_t rampLen) {
 
 }
 
+float besselI0(float x) {
+    /** Power series, converges quickly for the values of interest */
+    float sum = 1;
+    float term = 1;
+    for (auto k = 1; k < 32 && term > 1e-8f * sum; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+double kaiserSincTap(double x, int numTaps, float beta) {
+    const double sinc = x == 0 ? 1 : sin(pi * x) / (pi * x);
+    const double r = jmin(1., 2 * std::abs(x) / numTaps);
+    return sinc * besselI0(beta * sqrt(1 - r * r)) / besselI0(beta);
+}
+
+void delaysToFreq(CpxMtx &freq, const Vec &delays, int fftSize, int numBins) {
+    freq.resize(numBins, delays.size());
+    for (auto delayIdx = 0; delayIdx < delays.size(); delayIdx++) {
+        const auto step = std::polar(1., -2 * MathConstants<double>::pi * delays(delayIdx) / fftSize);
+        std::complex<double> phasor = 1;
+        for (auto binIdx = 0; binIdx < numBins; binIdx++) {
+            freq(binIdx, delayIdx) = std::complex<float>(phasor);
+            phasor *= step;
+        }
+    }
+}
+
 void
-freqToTime(AudioBuffer<float> &time, const int timeCh, const CpxVec &freq, const juce::dsp::FFT *fft, const Vec &window,
-           float alpha) {
+freqToTime(AudioBuffer<float> &time, const CpxMtx &freq, const FFTBackend *fft, const Vec &window, float alpha) {
 
     alpha = jlimit(0.f, 1.f, alpha);
 
-    AudioBuffer<float> tmp(1, fft->getSize() * 2);
-    tmp.clear();
-
-    FloatVectorOperations::copy(tmp.getWritePointer(0),
-                                (float *) (freq.data()),
-                                (fft->getSize() / 2 + 1) * 2);
-    fft->performRealOnlyInverseTransform(tmp.getWritePointer(0));
+    const int numChannels = jmin(time.getNumChannels(), (int) freq.cols());
 
-    if (window.size()) {
-        /** Apply windowing to IR */
-        FloatVectorOperations::multiply(tmp.getWritePointer(0), window.data(),
-                                        fft->getSize());
+    /** Split complex spectra, one column per channel */
+    const Mtx freqRe = freq.topRows(fft->getNumBins()).real();
+    const Mtx freqIm = freq.topRows(fft->getNumBins()).imag();
+    std::vector<const float *> re(numChannels), im(numChannels);
+    for (auto channelIdx = 0; channelIdx < numChannels; channelIdx++) {
+        re[channelIdx] = freqRe.col(channelIdx).data();
+        im[channelIdx] = freqIm.col(channelIdx).data();
     }
 
-    if (alpha < 1) {
-        /** Exp smoothing */
-        FloatVectorOperations::multiply(time.getWritePointer(timeCh), 1.f - alpha, time.getNumSamples());
-        FloatVectorOperations::addWithMultiply(time.getWritePointer(timeCh), tmp.getReadPointer(0), alpha,
-                                               time.getNumSamples());
-    } else {
-        FloatVectorOperations::copy(time.getWritePointer(timeCh), tmp.getReadPointer(0), time.getNumSamples());
+    AudioBuffer<float> tmp(numChannels, fft->getSize());
+    HeapBlock<float> scratch(fft->getScratchSize());
+    fft->performRealInverse(re.data(), im.data(), tmp.getArrayOfWritePointers(), numChannels, scratch);
+
+    for (auto channelIdx = 0; channelIdx < numChannels; channelIdx++) {
+        if (window.size()) {
+            /** Apply windowing to IR */
+            FloatVectorOperations::multiply(tmp.getWritePointer(channelIdx), window.data(),
+                                            fft->getSize());
+        }
+
+        if (alpha < 1) {
+            /** Exp smoothing */
+            FloatVectorOperations::multiply(time.getWritePointer(channelIdx), 1.f - alpha, time.getNumSamples());
+            FloatVectorOperations::addWithMultiply(time.getWritePointer(channelIdx), tmp.getReadPointer(channelIdx),
+                                                   alpha, time.getNumSamples());
+        } else {
+            FloatVectorOperations::copy(time.getWritePointer(channelIdx), tmp.getReadPointer(channelIdx),
+                                        time.getNumSamples());
+        }
     }
 
 }
@@ -9,6 +9,7 @@
 
 #include "../Eigen/Eigen"
 #include "../JuceLibraryCode/JuceHeader.h"
+#include "FFTBackend.h"
 
 typedef Eigen::Matrix<float, Eigen::Dynamic, 1> Vec;
 typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic> Mtx;
@@ -26,16 +27,43 @@ const Eigen::scomplex j2pi = std::complex<float>(0, 2 * pi);
  */
 void designTukeyWindow(Vec &win, size_t winLen, size_t rampLen);
 
-/** Convert a frequency domain signal to a time domain signal.
+/** Modified Bessel function of the first kind, order 0
+ 
+ Used to design Kaiser windows
+ */
+float besselI0(float x);
+
+/** Kaiser window shape of the fractional delay interpolators. About -45dB of error up to 80% of the Nyquist frequency
+ with 16 taps */
+const float kaiserBeta = 5;
+
+/** Tap of a Kaiser-windowed sinc interpolator
+ 
+ @param x: distance of the tap from the center of the filter [samples]
+ @param numTaps: length of the filter [samples]
+ @param beta: Kaiser window shape
+ */
+double kaiserSincTap(double x, int numTaps, float beta);
+
+/** Spectra of fractional delays, with a single complex exponential per delay
+ 
+ Bins are obtained by recursive rotation along frequency, in double precision.
+ @param freq: destination, one column per delay
+ @param delays: delays [samples]
+ @param fftSize: FFT size
+ @param numBins: number of non-negative frequency bins to be computed
+ */
+void delaysToFreq(CpxMtx &freq, const Vec &delays, int fftSize, int numBins);
+
+/** Convert frequency domain signals to time domain signals, all channels with a single batched transform.
  
  Optionally apply windowing and exponential smoothing.
  @param time: Destination time domain buffer
- @param timeCh:Time domain buffer destination channel
- @param freq: Source frequency domain signal
+ @param freq: Source frequency domain signals, one column per channel of time. Only non-negative frequencies are used
  @param fft: FFT object reference
  @param window: a windowing funciton in the time domain
  @param alpha: exponential interpolation coefficient. 1 means complete override (instant update), 0 means no override (complete preservation)
  
  */
-void freqToTime(AudioBuffer<float> &time, const int timeCh, const CpxVec &freq, const juce::dsp::FFT *fft,
+void freqToTime(AudioBuffer<float> &time, const CpxMtx &freq, const FFTBackend *fft,
                 const Vec &window = Vec(), float alpha = 1);
@@ -0,0 +1,23 @@
+/*
+ Lock-free slots handover
+
+ Authors:
+ Luca Bondi (luca.bondi@polimi.it)
+*/
+
+#include "SlotExchange.h"
+
+SlotExchange::SlotExchange(int sharedSlot) : shared(sharedSlot) {
+    jassert(sharedSlot >= 0 && sharedSlot < newFlag);
+}
+
+void SlotExchange::publish(int &slot) {
+    slot = shared.exchange(slot | newFlag) & ~newFlag;
+}
+
+bool SlotExchange::acquire(int &slot) {
+    if ((shared.load() & newFlag) == 0)
+        return false;
+    slot = shared.exchange(slot) & ~newFlag;
+    return true;
+}
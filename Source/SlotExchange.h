@@ -0,0 +1,43 @@
+/*
+ Lock-free slots handover
+
+ Authors:
+ Luca Bondi (luca.bondi@polimi.it)
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+/** Hands the most recent value over from a writer thread to a reader thread, through a shared slot
+
+ The values live in an array of slots kept by the caller, at least three. The writer and the reader each own at least
+ one slot and only access their own, one more slot is shared. The writer publishes the slot it just wrote by swapping
+ it with the shared one, the reader takes it by swapping one of its own. A single atomic exchange on each side: no
+ locks, no copies, values published while the reader wasn't looking are simply skipped.
+ */
+class SlotExchange {
+
+public:
+
+    /** @param sharedSlot: slot initially shared, neither the writer's nor the reader's one */
+    explicit SlotExchange(int sharedSlot);
+
+    /** Swap the slot owned by the writer, just written, with the shared one. Writer thread */
+    void publish(int &slot);
+
+    /** Swap the slot owned by the reader with the shared one if this was published since. Reader thread
+
+     @return true if swapped, slot then holds the most recent value
+     */
+    bool acquire(int &slot);
+
+private:
+
+    /** Index of the shared slot, flagged when it's new */
+    std::atomic<int> shared;
+
+    static const int newFlag = 0x100;
+
+    JUCE_DECLARE_NON_COPYABLE (SlotExchange)
+};
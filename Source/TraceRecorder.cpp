@@ -0,0 +1,250 @@
+/*
+ Timeline trace recorder
+
+ Authors:
+ Luca Bondi (luca.bondi@polimi.it)
+*/
+
+#include "TraceRecorder.h"
+
+// ==============================================================================
+TraceRecorder::ScopedEvent::ScopedEvent(TraceRecorder *recorder_, const char *name_, int arg)
+        : recorder(recorder_), name(name_) {
+    if (recorder != nullptr) {
+        recorder->record(begin, name, arg);
+    }
+}
+
+TraceRecorder::ScopedEvent::~ScopedEvent() {
+    if (recorder != nullptr) {
+        recorder->record(end, name);
+    }
+}
+
+// ==============================================================================
+TraceRecorder::TraceRecorder() : Thread("Trace writer") {
+}
+
+TraceRecorder::~TraceRecorder() {
+    stopRecording();
+}
+
+bool TraceRecorder::startRecording(const File &file) {
+    if (isRecording()) {
+        return false;
+    }
+
+    auto newStream = std::make_unique<FileOutputStream>(file);
+    if (newStream->failedToOpen()) {
+        return false;
+    }
+    newStream->setPosition(0);
+    newStream->truncate();
+
+    if (rings == nullptr) {
+        rings = std::make_unique<Ring[]>(maxNumRings);
+        for (auto ringIdx = 0; ringIdx < maxNumRings; ringIdx++) {
+            rings[ringIdx].events.allocate(ringSize, false);
+        }
+    }
+
+    stream = std::move(newStream);
+    *stream << "[\n";
+    firstEvent = true;
+    startTicks = Time::getHighResolutionTicks();
+    microsecondsPerTick = 1e6 / Time::getHighResolutionTicksPerSecond();
+
+    recording = true;
+    startThread(2);
+    return true;
+}
+
+void TraceRecorder::stopRecording() {
+    if (!isRecording()) {
+        return;
+    }
+
+    recording = false;
+
+    /** Producers that found the recording on are done within a few instructions */
+    while (numActiveProducers.load() > 0) {
+        Thread::yield();
+    }
+
+    notify();
+    stopThread(1000);
+    drain();
+
+    /** Rings are claimed afresh by the next recording */
+    for (auto ringIdx = 0; ringIdx < maxNumRings; ringIdx++) {
+        resetRing(rings[ringIdx]);
+        rings[ringIdx].owner = nullptr;
+    }
+    const auto endTime = String((Time::getHighResolutionTicks() - startTicks) * microsecondsPerTick, 3);
+    if (numUnclaimedDropped > 0) {
+        writeEvent("{\"name\":\"Dropped events, too many threads\",\"ph\":\"i\",\"s\":\"p\",\"ts\":" + endTime +
+                   ",\"pid\":1,\"tid\":0,\"args\":{\"arg\":" + String(numUnclaimedDropped.load()) + "}}");
+        numUnclaimedDropped = 0;
+    }
+
+    *stream << "\n]\n";
+    stream->flush();
+    stream.reset();
+}
+
+void TraceRecorder::record(Phase phase, const char *name, int64 ticks, int arg) {
+    if (!isRecording()) {
+        return;
+    }
+
+    /** Announce the write, then make sure the recording was not stopped in the meantime */
+    numActiveProducers++;
+    if (recording) {
+        if (auto ring = getThreadRing()) {
+            const auto writePos = ring->writePos.load(std::memory_order_relaxed);
+            if (writePos - ring->readPos.load(std::memory_order_acquire) < (uint32) ringSize) {
+                ring->events[writePos % ringSize] = {ticks, name, arg, (char) phase};
+                ring->writePos.store(writePos + 1, std::memory_order_release);
+            } else {
+                ring->numDropped.fetch_add(1, std::memory_order_relaxed);
+            }
+            ring->writing.store(false, std::memory_order_release);
+        } else {
+            numUnclaimedDropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    numActiveProducers--;
+}
+
+void TraceRecorder::record(Phase phase, const char *name, int arg) {
+    if (isRecording()) {
+        record(phase, name, Time::getHighResolutionTicks(), arg);
+    }
+}
+
+TraceRecorder::Ring *TraceRecorder::getThreadRing() {
+    const auto threadId = Thread::getCurrentThreadId();
+
+    /** Rings are claimed in order, a thread finds its own before the first free one */
+    for (auto ringIdx = 0; ringIdx < maxNumRings; ringIdx++) {
+        auto &ring = rings[ringIdx];
+        auto owner = ring.owner.load(std::memory_order_acquire);
+        if (owner == nullptr && ring.owner.compare_exchange_strong(owner, threadId)) {
+            /** Not a JUCE thread, most likely the host audio thread */
+            const auto thread = Thread::getCurrentThread();
+            if (thread != nullptr) {
+                thread->getThreadName().copyToUTF8(ring.threadName, sizeof(ring.threadName));
+            } else {
+                std::strncpy(ring.threadName, "Host thread", sizeof(ring.threadName));
+            }
+            /** Same timeline for all the rings of a thread */
+            ring.tid = (int64) (pointer_sized_int) threadId;
+            owner = threadId;
+        }
+        if (owner == threadId) {
+            /** Either this thread sees the ring being reclaimed, or the writer thread sees it being written */
+            ring.writing = true;
+            if (ring.owner.load() == threadId) {
+                return &ring;
+            }
+            ring.writing = false;
+        }
+    }
+    return nullptr;
+}
+
+void TraceRecorder::run() {
+    while (!threadShouldExit()) {
+        drain();
+        wait(drainInterval);
+    }
+}
+
+void TraceRecorder::drain() {
+    const auto now = Time::getHighResolutionTicks();
+    const auto reclaimTicks = Time::secondsToHighResolutionTicks(reclaimTime);
+    for (auto ringIdx = 0; ringIdx < maxNumRings; ringIdx++) {
+        auto &ring = rings[ringIdx];
+        const auto owner = ring.owner.load(std::memory_order_acquire);
+        if (owner != ring.lastOwner) {
+            ring.lastOwner = owner;
+            ring.lastActiveTicks = now;
+        }
+        if (ring.readPos.load(std::memory_order_relaxed) != ring.writePos.load(std::memory_order_acquire)) {
+            drainRing(ring);
+            ring.lastActiveTicks = now;
+        } else if (owner != nullptr && now - ring.lastActiveTicks > reclaimTicks) {
+            reclaimRing(ring);
+        }
+    }
+}
+
+void TraceRecorder::drainRing(Ring &ring) {
+    const auto writePos = ring.writePos.load(std::memory_order_acquire);
+    auto readPos = ring.readPos.load(std::memory_order_relaxed);
+    if (readPos == writePos) {
+        return;
+    }
+
+    const String tid(ring.tid);
+    if (!ring.named) {
+        writeEvent("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + tid + ",\"args\":{\"name\":\"" +
+                   String(ring.threadName).replaceCharacter('"', '\'') + "\"}}");
+        ring.named = true;
+    }
+
+    for (; readPos != writePos; readPos++) {
+        const auto &event = ring.events[readPos % ringSize];
+        String json;
+        json << "{\"name\":\"" << event.name << "\",\"ph\":\"" << String::charToString(event.phase) << "\"";
+        if (event.phase == instant) {
+            json << ",\"s\":\"t\"";
+        }
+        json << ",\"ts\":" << String((event.ticks - startTicks) * microsecondsPerTick, 3) << ",\"pid\":1,\"tid\":"
+             << tid;
+        if (event.arg != noArg) {
+            json << ",\"args\":{\"arg\":" << String(event.arg) << "}";
+        }
+        json << "}";
+        writeEvent(json);
+    }
+    ring.readPos.store(readPos, std::memory_order_release);
+}
+
+void TraceRecorder::reclaimRing(Ring &ring) {
+    auto owner = ring.owner.load();
+    if (!ring.owner.compare_exchange_strong(owner, (Thread::ThreadID) &ring)) {
+        return;
+    }
+
+    /** Back to its owner if it started writing meanwhile */
+    if (ring.writing.load()) {
+        ring.owner = owner;
+        return;
+    }
+    drainRing(ring);
+    resetRing(ring);
+    ring.owner.store(nullptr, std::memory_order_release);
+}
+
+void TraceRecorder::resetRing(Ring &ring) {
+    if (ring.numDropped > 0) {
+        const auto time = String((Time::getHighResolutionTicks() - startTicks) * microsecondsPerTick, 3);
+        writeEvent("{\"name\":\"Dropped events\",\"ph\":\"i\",\"s\":\"t\",\"ts\":" + time +
+                   ",\"pid\":1,\"tid\":" + String(ring.tid) +
+                   ",\"args\":{\"arg\":" + String(ring.numDropped.load()) + "}}");
+    }
+    ring.writePos = 0;
+    ring.readPos = 0;
+    ring.numDropped = 0;
+    ring.named = false;
+    ring.lastOwner = nullptr;
+}
+
+void TraceRecorder::writeEvent(const String &json) {
+    if (!firstEvent) {
+        *stream << ",\n";
+    }
+    *stream << json;
+    firstEvent = false;
+}
@@ -0,0 +1,160 @@
+/*
+ Timeline trace recorder
+
+ Authors:
+ Luca Bondi (luca.bondi@polimi.it)
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+/** Records timestamped begin, end and instant events from any thread, and writes them to a Chrome trace file
+
+ Each producing thread gets its own single-producer single-consumer ring of events, claimed on its first event.
+ Rings without events for reclaimTime are reclaimed, so that threads that exited, e.g. the ones of replaced
+ beamformers, don't hold a ring for the rest of the recording. A thread still alive claims a ring again on its next
+ event, on the same timeline. Producers never lock, allocate or wait: when a ring is full, or all the rings are
+ claimed, events are dropped and counted. A background thread drains the rings into a JSON file in the Trace Event Format, that can be opened with
+ chrome://tracing or https://ui.perfetto.dev
+
+ While not recording, each event costs a single relaxed atomic load.
+ */
+class TraceRecorder : private Thread {
+
+public:
+
+    /** Events phases, as in the Trace Event Format */
+    enum Phase {
+        begin = 'B',
+        end = 'E',
+        instant = 'i'
+    };
+
+    /** Events without an argument */
+    static const int noArg = std::numeric_limits<int>::min();
+
+    /** Marks a scope with a begin and an end event. No-op with a nullptr recorder or when not recording */
+    class ScopedEvent {
+    public:
+        /** @param name: string literal, or any string that outlives the recording */
+        ScopedEvent(TraceRecorder *recorder, const char *name, int arg = noArg);
+
+        ~ScopedEvent();
+
+    private:
+        TraceRecorder *recorder;
+        const char *name;
+
+        JUCE_DECLARE_NON_COPYABLE(ScopedEvent)
+    };
+
+    TraceRecorder();
+
+    /** Destructor. Stops recording */
+    ~TraceRecorder();
+
+    /** Start recording to a file, replacing it. Not from the real-time threads
+
+     @return false if already recording or if the file can't be written
+     */
+    bool startRecording(const File &file);
+
+    /** Stop recording and complete the file. Not from the real-time threads */
+    void stopRecording();
+
+    /** True while recording. Any thread */
+    bool isRecording() const { return recording.load(std::memory_order_relaxed); }
+
+    /** Record an event. Any thread, real-time safe
+
+     @param name: string literal, or any string that outlives the recording
+     @param ticks: timestamp [high resolution ticks]
+     @param arg: optional argument, e.g. a source index
+     */
+    void record(Phase phase, const char *name, int64 ticks, int arg = noArg);
+
+    /** Record an event timestamped now. Any thread, real-time safe */
+    void record(Phase phase, const char *name, int arg = noArg);
+
+private:
+
+    /** Events per thread between two drains */
+    static const int ringSize = 4096;
+    /** Maximum number of producing threads per recording */
+    static const int maxNumRings = 32;
+    /** Interval between drains [ms] */
+    static const int drainInterval = 20;
+    /** Time without events after which a ring is reclaimed [s] */
+    static constexpr double reclaimTime = 1;
+
+    struct Event {
+        int64 ticks;
+        const char *name;
+        int arg;
+        char phase;
+    };
+
+    struct Ring {
+        /** Producing thread, nullptr if unclaimed. The address of the ring while being reclaimed */
+        std::atomic<Thread::ThreadID> owner{nullptr};
+        /** Set by the producer from finding its ring to the end of its write, the ring is not reclaimed meanwhile */
+        std::atomic<bool> writing{false};
+        /** Name and timeline of the producing thread, set before its first event */
+        char threadName[32];
+        int64 tid = 0;
+        /** Written by the producer */
+        std::atomic<uint32> writePos{0};
+        /** Written by the writer thread */
+        std::atomic<uint32> readPos{0};
+        std::atomic<int64> numDropped{0};
+        /** Thread name written to the file. Writer thread only */
+        bool named = false;
+        /** Owner at the last drain, and time of its last event or of its claim [ticks]. Writer thread only */
+        Thread::ThreadID lastOwner = nullptr;
+        int64 lastActiveTicks = 0;
+        HeapBlock<Event> events;
+    };
+
+    /** Allocated by the first recording, kept until destruction */
+    std::unique_ptr<Ring[]> rings;
+
+    std::atomic<bool> recording{false};
+
+    /** Producers between the recording check and the end of their write */
+    std::atomic<int> numActiveProducers{0};
+
+    /** Events dropped because all the rings were claimed */
+    std::atomic<int64> numUnclaimedDropped{0};
+
+    /** Output file. Writer thread only while recording */
+    std::unique_ptr<FileOutputStream> stream;
+    bool firstEvent = true;
+    int64 startTicks = 0;
+    double microsecondsPerTick = 0;
+
+    void run() override;
+
+    /** Find the ring of the calling thread, claiming a free one if needed. nullptr if all claimed
+
+     The ring is marked as being written, the caller clears writing once done.
+     */
+    Ring *getThreadRing();
+
+    /** Write the pending events of all the rings to the file, and reclaim the idle rings */
+    void drain();
+
+    /** Write the pending events of a ring to the file */
+    void drainRing(Ring &ring);
+
+    /** Reclaim an idle ring, unless its producer is writing */
+    void reclaimRing(Ring &ring);
+
+    /** Write the number of events dropped by a ring, then clear it for the next owner */
+    void resetRing(Ring &ring);
+
+    /** Write one JSON object to the file */
+    void writeEvent(const String &json);
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (TraceRecorder)
+};
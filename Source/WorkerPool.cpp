@@ -0,0 +1,165 @@
+/*
+ Worker threads pool for the audio thread
+
+ Authors:
+ Luca Bondi (luca.bondi@polimi.it)
+*/
+
+#include "WorkerPool.h"
+
+#if JUCE_INTEL
+#include <immintrin.h>
+#endif
+
+/** Hint the CPU that this is a spin-wait loop, so that it doesn't starve its sibling hyper-thread */
+static inline void spinPause() {
+#if JUCE_INTEL
+    _mm_pause();
+#endif
+}
+
+// ==============================================================================
+WorkerPool::Worker::Worker(WorkerPool &pool_) : Thread("Beamformer worker"), pool(pool_) {
+}
+
+WorkerPool::Worker::~Worker() {
+    stopThread(1000);
+}
+
+void WorkerPool::Worker::run() {
+    uint32 generation = (uint32) (pool.state.load() >> 32);
+
+    while (!threadShouldExit()) {
+        const auto newGeneration = (uint32) (pool.state.load() >> 32);
+        const auto sinceJobStart = Time::getHighResolutionTicks() - pool.jobStartTicks.load(std::memory_order_relaxed);
+        if (newGeneration != generation) {
+            generation = newGeneration;
+            pool.processTiles(generation);
+        } else if (sinceJobStart < pool.spinTicks.load(std::memory_order_relaxed)) {
+            /** Jobs keep arriving, the next one is due within the spinning window */
+            Thread::yield();
+        } else {
+            /** No job for a while, check again after a short sleep */
+            wait(sleepInterval);
+        }
+    }
+}
+
+// ==============================================================================
+WorkerPool::WorkerPool(int numWorkers) : job(nullptr), state(0), numLateTiles(0), jobStartTicks(0) {
+    for (auto &tile : tiles) {
+        tile = makeTileState(0, idle);
+    }
+    setJobPeriod(defaultJobPeriod);
+    for (auto workerIdx = 0; workerIdx < numWorkers; workerIdx++) {
+        workers.push_back(std::make_unique<Worker>(*this));
+        workers.back()->startThread(9);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    workers.clear();
+}
+
+void WorkerPool::setJobPeriod(double seconds) {
+    const auto ticksPerSecond = (double) Time::getHighResolutionTicksPerSecond();
+    spinTicks = (int64) (spinFraction * seconds * ticksPerSecond);
+    maxWaitTicks = (int64) (maxWaitFraction * seconds * ticksPerSecond);
+}
+
+void WorkerPool::run(Job &job_, int numTiles) {
+    jassert(numTiles <= maxNumTiles);
+
+    /** All the tiles of the previous job are completed or abandoned, the job is only read before claiming a tile */
+    job = &job_;
+
+    /** Publish the job */
+    jobStartTicks.store(Time::getHighResolutionTicks(), std::memory_order_relaxed);
+    const auto generation = ++lastGeneration;
+    state = ((uint64) generation << 32) | ((uint64) numTiles << 16);
+
+    /** Take part in the job */
+    processTiles(generation);
+
+    /** Tiles claimed by the workers are being processed, wait for them until the deadline. Then take them over */
+    const auto deadline = Time::getHighResolutionTicks() + maxWaitTicks.load(std::memory_order_relaxed);
+    const auto doneState = makeTileState(generation, done);
+    for (auto tileIdx = 0; tileIdx < numTiles; tileIdx++) {
+        auto &tile = tiles[tileIdx];
+        auto tileState = tile.load(std::memory_order_acquire);
+        while (tileState != doneState && Time::getHighResolutionTicks() < deadline) {
+            spinPause();
+            tileState = tile.load(std::memory_order_acquire);
+        }
+
+        if (tileState != doneState) {
+            /** A worker still busy is abandoned. A worker that claimed the tile but didn't start yet is locked out
+             by the generation of the idle state. A late worker of a previous job keeps the tile memory */
+            bool takenOver = false;
+            while (!takenOver && tileState != doneState) {
+                const auto status = (TileStatus) (tileState & 0xff);
+                if (status == busy) {
+                    takenOver = tile.compare_exchange_weak(tileState, makeTileState(generation, abandoned));
+                } else if (status == idle && isOlder((uint32) (tileState >> 32), generation)) {
+                    takenOver = tile.compare_exchange_weak(tileState, makeTileState(generation, idle));
+                } else {
+                    takenOver = true;
+                }
+            }
+            if (takenOver) {
+                numLateTiles.fetch_add(1, std::memory_order_relaxed);
+                AllocationTripwire::ScopedArm noAllocations;
+                job_.processTile(tileIdx, true);
+                job_.completeTile(tileIdx, true);
+                continue;
+            }
+        }
+
+        job_.completeTile(tileIdx, false);
+        tile.store(makeTileState(generation, idle), std::memory_order_release);
+    }
+}
+
+bool WorkerPool::isTileIdle(int tileIdx) const {
+    jassert(tileIdx < maxNumTiles);
+    return (tiles[tileIdx].load(std::memory_order_acquire) & 0xff) == idle;
+}
+
+void WorkerPool::waitForLateWorkers() const {
+    for (const auto &tile : tiles) {
+        while ((tile.load(std::memory_order_acquire) & 0xff) != idle) {
+            Thread::sleep(1);
+        }
+    }
+}
+
+void WorkerPool::processTiles(uint32 generation) {
+    /** Tiles are part of the audio callback */
+    AllocationTripwire::ScopedArm noAllocations;
+
+    auto s = state.load();
+    while (true) {
+        const auto numTiles = (int) ((s >> 16) & 0xffff);
+        const auto tileIdx = (int) (s & 0xffff);
+        if ((uint32) (s >> 32) != generation || tileIdx >= numTiles)
+            return;
+        if (!state.compare_exchange_weak(s, s + 1))
+            continue;
+
+        /** The job is read before locking the tile, so that it can't be the one of a newer generation */
+        const auto tileJob = job.load();
+        auto &tile = tiles[tileIdx];
+        auto tileState = tile.load(std::memory_order_acquire);
+        if ((tileState & 0xff) == idle && isOlder((uint32) (tileState >> 32), generation) &&
+            tile.compare_exchange_strong(tileState, makeTileState(generation, busy))) {
+            tileJob->processTile(tileIdx, false);
+
+            /** Abandoned in the meantime: the result is discarded, the memory of the tile is free again */
+            auto busyState = makeTileState(generation, busy);
+            if (!tile.compare_exchange_strong(busyState, makeTileState(generation, done))) {
+                tile.store(makeTileState(generation, idle), std::memory_order_release);
+            }
+        }
+        s = state.load();
+    }
+}
@@ -0,0 +1,170 @@
+/*
+ Worker threads pool for the audio thread
+
+ Authors:
+ Luca Bondi (luca.bondi@polimi.it)
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "AllocationTripwire.h"
+
+/** Pool of pre-spawned threads helping the audio thread to process a job split in independent tiles
+
+ Tiles are claimed through an atomic counter, by the workers and by the calling thread alike. Nothing is allocated
+ and no lock is taken by the calling thread, which processes by itself all the tiles that the workers don't claim in
+ time: if the workers are late or asleep, the job is simply completed single-threaded.
+ Tiles claimed by a worker are waited for until a deadline, a fraction of the job period. Past the deadline the
+ worker is abandoned and the calling thread processes the tile again in its own private memory, so that a worker
+ preempted in the middle of a tile never holds up the audio thread. Workers only write to the memory of their tile,
+ the result is used by the calling thread once the tile is completed.
+ Workers spin from the start of each job until past the expected start of the next one, so that they are awake
+ for every job as long as jobs keep arriving. Once the pool is idle they poll for the next job every sleepInterval.
+ The calling thread never wakes them: notifying a thread takes a lock, that a preempted worker may be holding.
+ */
+class WorkerPool {
+
+public:
+
+    /** A job split in tiles */
+    class Job {
+    public:
+        virtual ~Job() {};
+
+        /** Process a tile. Tiles of the same job are processed concurrently
+
+         @param fallback: false to process into the memory of the tile. true on the calling thread only, to process
+                          into memory private to the calling thread: the memory of the tile may still be in use by
+                          a late worker
+         */
+        virtual void processTile(int tileIdx, bool fallback) = 0;
+
+        /** Use the result of a processed tile, on the calling thread
+
+         @param fallback: whether the tile was processed with fallback
+         */
+        virtual void completeTile(int tileIdx, bool fallback) = 0;
+    };
+
+    /** Start the worker threads
+
+     @param numWorkers: number of worker threads, in addition to the calling thread
+     */
+    WorkerPool(int numWorkers);
+
+    /** Destructor. Stops the worker threads */
+    ~WorkerPool();
+
+    /** Set the expected time between jobs, that bounds the workers spinning and the wait for late workers
+
+     @param seconds: job period [s], e.g. the duration of a block of samples
+     */
+    void setJobPeriod(double seconds);
+
+    /** Process and complete all the tiles of a job. Returns within the deadline after the calling thread is done
+     with the tiles no worker claimed, unless the job period is longer than the tiles themselves
+
+     @param job: job to be processed
+     @param numTiles: number of tiles, at most maxNumTiles
+     */
+    void run(Job &job, int numTiles);
+
+    /** Whether the memory of a tile is not in use by a late worker. From the calling thread, between jobs */
+    bool isTileIdle(int tileIdx) const;
+
+    /** Wait for the late workers to leave their tiles, e.g. before a job is destroyed. Not on the audio thread */
+    void waitForLateWorkers() const;
+
+    /** Get the number of workers abandoned past the deadline, since construction. Any thread */
+    int64 getNumLateTiles() const { return numLateTiles.load(std::memory_order_relaxed); }
+
+    /** Get the number of worker threads */
+    int getNumWorkers() const { return (int) workers.size(); };
+
+    /** Maximum number of tiles of a job */
+    static const int maxNumTiles = 256;
+
+private:
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (WorkerPool);
+
+    class Worker : public Thread {
+    public:
+        Worker(WorkerPool &pool);
+
+        ~Worker();
+
+        void run() override;
+
+    private:
+        WorkerPool &pool;
+    };
+
+    /** Status of a tile, in the lower bits of its state. The upper 32 bits hold the generation of the job */
+    enum TileStatus {
+        /** Memory of the tile free */
+        idle,
+        /** Being processed */
+        busy,
+        /** Processed, waiting to be completed by the calling thread */
+        done,
+        /** Being processed by a worker past the deadline, the result will be discarded */
+        abandoned
+    };
+
+    static uint64 makeTileState(uint32 generation, TileStatus status) {
+        return ((uint64) generation << 32) | status;
+    }
+
+    /** Whether a generation precedes another one, across the wrap-around */
+    static bool isOlder(uint32 generation, uint32 other) {
+        return (int32) (other - generation) > 0;
+    }
+
+    /** Claim and process tiles of a job until none is left
+
+     @param generation: job generation
+     */
+    void processTiles(uint32 generation);
+
+    /** Worker threads */
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    /** Job being processed */
+    std::atomic<Job *> job;
+
+    /** Job generation (32 bits), number of tiles (16 bits) and next tile to be claimed (16 bits).
+     Packed in a single atomic, so that a late worker can never claim a tile of a newer job */
+    std::atomic<uint64> state;
+
+    /** Generation and status of each tile */
+    std::atomic<uint64> tiles[maxNumTiles];
+
+    /** Number of tiles abandoned past the deadline */
+    std::atomic<int64> numLateTiles;
+
+    /** Generation of the last job, only accessed by the calling thread */
+    uint32 lastGeneration = 0;
+
+    /** Start of the last job [ticks] */
+    std::atomic<int64> jobStartTicks;
+
+    /** Time spent spinning by the workers from the start of each job, before going to sleep [ticks] */
+    std::atomic<int64> spinTicks;
+
+    /** Longest wait for the workers after the calling thread is done with its tiles [ticks] */
+    std::atomic<int64> maxWaitTicks;
+
+    /** Spinning and wait for late workers, as fractions of the job period. Spinning covers the next job, with
+     some margin for the jitter of the callbacks */
+    const double spinFraction = 1.25;
+    const double maxWaitFraction = 0.1;
+
+    /** Time between polls of a worker after spinning [ms] */
+    static const int sleepInterval = 1;
+
+    /** Job period until set [s] */
+    const double defaultJobPeriod = 0.005;
+
+};
@@ -21,3 +21,37 @@ bool isLinearArray(MicConfig m){
             return false;
     }
 };
+
+int getNumMic(MicConfig m){
+    switch(m){
+        case ULA_1ESTICK:
+            return 16;
+        case ULA_2ESTICK:
+        case URA_2ESTICK:
+            return 32;
+        case ULA_3ESTICK:
+        case URA_3ESTICK:
+            return 48;
+        case ULA_4ESTICK:
+        case URA_4ESTICK:
+        case URA_2x2ESTICK:
+            return 64;
+    }
+}
+
+int getNumRows(MicConfig m){
+    switch(m){
+        case ULA_1ESTICK:
+        case ULA_2ESTICK:
+        case ULA_3ESTICK:
+        case ULA_4ESTICK:
+            return 1;
+        case URA_2ESTICK:
+        case URA_2x2ESTICK:
+            return 2;
+        case URA_3ESTICK:
+            return 3;
+        case URA_4ESTICK:
+            return 4;
+    }
+}
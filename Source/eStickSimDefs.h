@@ -34,4 +34,24 @@ const StringArray micConfigLabels({
                                           "Stack 2x2",
                                   });
 
+/** Available rendering modes */
+typedef enum {
+    CONVOLUTION,
+    FRACTIONAL_DELAY,
+    VARIABLE_DELAY,
+} RenderingMode;
+
+/** Available rendering modes labels */
+const StringArray renderingModeLabels({
+                                              "Convolution",
+                                              "Fractional delay",
+                                              "Variable delay",
+                                      });
+
 bool isLinearArray(MicConfig m);
+
+/** Number of microphones of a configuration */
+int getNumMic(MicConfig m);
+
+/** Number of rows of a configuration, one per stacked eStick */
+int getNumRows(MicConfig m);
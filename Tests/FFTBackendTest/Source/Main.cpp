@@ -0,0 +1,136 @@
+/*
+ FFT backends consistency test
+
+ Runs the same forward and inverse transforms with the Stockham and the JUCE backends and compares the results, for
+ all the FFT orders the convolution engines and the beamforming algorithms can ask for, with batches of even and odd
+ numbers of channels and with inputs shorter than the FFT size. Exits with 0 if the backends agree.
+
+ Authors:
+ Luca Bondi (luca.bondi@polimi.it)
+*/
+
+#include "../../../Source/FFTBackend.h"
+
+//==============================================================================
+/** Smallest and largest FFT order checked.
+ Covers the FIR design and the convolution partitions, from the shortest head up to the longest tail stage */
+static const int minOrder = 1;
+static const int maxOrder = 17;
+
+/** Batch sizes checked [channels]. Odd batches exercise the unpaired channel of the JUCE inverse transform */
+static const int numChannelsList[] = {1, 2, 3, 4, 7};
+
+/** Largest error allowed, relative to the largest magnitude of the reference */
+static const float tolerance = 1e-5f;
+
+/** Batch of arrays, with the pointer arrays the backends take */
+struct Batch {
+    Batch(int numChannels, int numSamples) : data(numChannels, numSamples) {}
+
+    float *const *write() { return data.getArrayOfWritePointers(); }
+
+    const float *const *read() const { return data.getArrayOfReadPointers(); }
+
+    AudioBuffer<float> data;
+};
+
+/** Largest difference between the first numSamples of a and b, relative to the largest magnitude of a */
+static float relativeError(const Batch &a, const Batch &b, int numSamples) {
+    float maxDiff = 0;
+    float maxAbs = 0;
+    for (auto channelIdx = 0; channelIdx < a.data.getNumChannels(); channelIdx++) {
+        for (auto smpIdx = 0; smpIdx < numSamples; smpIdx++) {
+            const float valA = a.data.getSample(channelIdx, smpIdx);
+            const float valB = b.data.getSample(channelIdx, smpIdx);
+            maxDiff = jmax(maxDiff, std::abs(valA - valB));
+            maxAbs = jmax(maxAbs, std::abs(valA));
+        }
+    }
+    return maxAbs > 0 ? maxDiff / maxAbs : maxDiff;
+}
+
+static void fillRandom(Batch &batch, Random &random) {
+    for (auto channelIdx = 0; channelIdx < batch.data.getNumChannels(); channelIdx++) {
+        for (auto smpIdx = 0; smpIdx < batch.data.getNumSamples(); smpIdx++) {
+            batch.data.setSample(channelIdx, smpIdx, random.nextFloat() * 2 - 1);
+        }
+    }
+}
+
+//==============================================================================
+int main(int argc, char *argv[]) {
+
+    Random random(1);
+    float maxForwardError = 0;
+    float maxInverseError = 0;
+    float maxRoundTripError = 0;
+    bool passed = true;
+
+    for (auto order = minOrder; order <= maxOrder; order++) {
+        const auto juce = FFTBackend::create(order, FFT_BACKEND_JUCE);
+        const auto stockham = FFTBackend::create(order, FFT_BACKEND_STOCKHAM);
+        const int size = juce->getSize();
+        const int numBins = juce->getNumBins();
+        jassert(stockham->getSize() == size && stockham->getNumBins() == numBins);
+
+        HeapBlock<float> scratch(jmax(juce->getScratchSize(), stockham->getScratchSize()));
+
+        /** Full size, odd length and single sample inputs, zero-padded by the backends */
+        const int numSamplesList[] = {size, size / 2 + 1, 1};
+
+        float orderForwardError = 0;
+        float orderInverseError = 0;
+        float orderRoundTripError = 0;
+        for (auto numChannels : numChannelsList) {
+            for (auto numSamples : numSamplesList) {
+                Batch in(numChannels, numSamples);
+                fillRandom(in, random);
+
+                /** Forward */
+                Batch juceRe(numChannels, numBins), juceIm(numChannels, numBins);
+                Batch stockhamRe(numChannels, numBins), stockhamIm(numChannels, numBins);
+                juce->performRealForward(in.read(), numSamples, juceRe.write(), juceIm.write(), numChannels,
+                                         scratch);
+                stockham->performRealForward(in.read(), numSamples, stockhamRe.write(), stockhamIm.write(),
+                                             numChannels, scratch);
+                orderForwardError = jmax(orderForwardError, relativeError(juceRe, stockhamRe, numBins),
+                                         relativeError(juceIm, stockhamIm, numBins));
+
+                /** Inverse of the spectra just computed, back to the input */
+                Batch juceOut(numChannels, size), stockhamOut(numChannels, size);
+                juce->performRealInverse(juceRe.read(), juceIm.read(), juceOut.write(), numChannels, scratch);
+                stockham->performRealInverse(stockhamRe.read(), stockhamIm.read(), stockhamOut.write(),
+                                             numChannels, scratch);
+                Batch padded(numChannels, size);
+                padded.data.clear();
+                for (auto channelIdx = 0; channelIdx < numChannels; channelIdx++) {
+                    padded.data.copyFrom(channelIdx, 0, in.data, channelIdx, 0, numSamples);
+                }
+                orderRoundTripError = jmax(orderRoundTripError, relativeError(padded, juceOut, size),
+                                           relativeError(padded, stockhamOut, size));
+
+                /** Inverse of arbitrary spectra. Imaginary parts of DC and Nyquist must be ignored by both */
+                fillRandom(juceRe, random);
+                fillRandom(juceIm, random);
+                juce->performRealInverse(juceRe.read(), juceIm.read(), juceOut.write(), numChannels, scratch);
+                stockham->performRealInverse(juceRe.read(), juceIm.read(), stockhamOut.write(), numChannels,
+                                             scratch);
+                orderInverseError = jmax(orderInverseError, relativeError(juceOut, stockhamOut, size));
+            }
+        }
+
+        const bool orderPassed = orderForwardError <= tolerance && orderInverseError <= tolerance &&
+                                 orderRoundTripError <= tolerance;
+        std::cout << "Order " << order << ": forward " << orderForwardError << ", inverse " << orderInverseError
+                  << ", round trip " << orderRoundTripError << (orderPassed ? "" : " FAILED") << std::endl;
+
+        passed = passed && orderPassed;
+        maxForwardError = jmax(maxForwardError, orderForwardError);
+        maxInverseError = jmax(maxInverseError, orderInverseError);
+        maxRoundTripError = jmax(maxRoundTripError, orderRoundTripError);
+    }
+
+    std::cout << "Largest relative errors: forward " << maxForwardError << ", inverse " << maxInverseError
+              << ", round trip " << maxRoundTripError << ". Tolerance " << tolerance << std::endl;
+    return passed ? 0 : 1;
+}
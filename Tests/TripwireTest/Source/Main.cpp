@@ -0,0 +1,148 @@
+/*
+ Allocation tripwire test
+
+ Drives the processor as a host would, in real time, with automation, configuration changes and impulse responses
+ loaded on the way. The audio thread is armed by processBlock itself: the first allocation or deallocation aborts
+ the test, a clean run exits with 0.
+
+ Authors:
+ Luca Bondi (luca.bondi@polimi.it)
+*/
+
+#include "../../../Source/PluginProcessor.h"
+
+//==============================================================================
+/** Find a parameter of the processor by its ID */
+static RangedAudioParameter &getParameter(AudioProcessor &processor, const String &paramID) {
+    for (auto param : processor.getParameters()) {
+        if (auto ranged = dynamic_cast<RangedAudioParameter *>(param)) {
+            if (ranged->paramID == paramID) {
+                return *ranged;
+            }
+        }
+    }
+    jassertfalse;
+    std::abort();
+}
+
+/** Set a parameter from its plain value, as the host automation does */
+static void setParameter(AudioProcessor &processor, const String &paramID, float value) {
+    auto &param = getParameter(processor, paramID);
+    param.setValue(param.convertTo0to1(value));
+}
+
+/** Impulse responses of a decaying reverb, one channel per microphone */
+static AudioBuffer<float> makeImpulseResponse(double sampleRate, float length, Random &random) {
+    AudioBuffer<float> ir(64, roundToInt(length * sampleRate));
+    for (auto micIdx = 0; micIdx < ir.getNumChannels(); micIdx++) {
+        for (auto sampleIdx = 0; sampleIdx < ir.getNumSamples(); sampleIdx++) {
+            const float decay = std::exp(-6.9f * sampleIdx / ir.getNumSamples());
+            ir.setSample(micIdx, sampleIdx, decay * (random.nextFloat() - 0.5f) * 0.1f);
+        }
+    }
+    return ir;
+}
+
+//==============================================================================
+int main(int argc, char *argv[]) {
+    ScopedJuceInitialiser_GUI juceInitialiser;
+
+    if (!AllocationTripwire::isEnabled()) {
+        std::cerr << "Build with ESTICK_ALLOCATION_TRIPWIRE=1" << std::endl;
+        return 1;
+    }
+
+    const double sampleRate = 48000;
+    const int maxBlockSize = 512;
+    /** Some hosts send blocks larger than announced to prepareToPlay */
+    const int largestBlockSize = 2 * maxBlockSize;
+    /** Test duration [s] */
+    const double duration = 12;
+
+    EstickSimAudioProcessor processor;
+    processor.setRateAndBufferSizeDetails(sampleRate, maxBlockSize);
+    processor.prepareToPlay(sampleRate, maxBlockSize);
+
+    AudioBuffer<float> buffer(jmax(processor.getTotalNumInputChannels(), processor.getTotalNumOutputChannels()),
+                              largestBlockSize);
+    MidiBuffer midi;
+    Random random(1);
+
+    /** Timeline of the test [s] */
+    const double configSwitchTime = 2;
+    const double impulseResponseTime = 4;
+    const double renderingModeTime = 6;
+    const double configBackTime = 7;
+    const double muteTime = 8;
+    const double silenceTime = 9;
+    const double clearImpulseResponseTime = 10;
+
+    int64 numBlocks = 0;
+    int64 numSamples = 0;
+    const auto startTime = Time::getMillisecondCounterHiRes();
+    double prevTime = 0;
+    while (numSamples < duration * sampleRate) {
+        const double time = numSamples / sampleRate;
+        const auto crossed = [&](double eventTime) { return prevTime <= eventTime && time > eventTime; };
+
+        /** Changes from the message thread, outside of processBlock */
+        if (crossed(impulseResponseTime)) {
+            processor.setImpulseResponse(0, makeImpulseResponse(sampleRate, 1.5, random));
+        }
+        if (crossed(clearImpulseResponseTime)) {
+            processor.clearImpulseResponse(0);
+        }
+
+        /** Host automation */
+        for (auto srcIdx = 0; srcIdx < NUM_SOURCES; srcIdx++) {
+            const String suffix(srcIdx + 1);
+            setParameter(processor, "steerX" + suffix, (float) std::sin(time * (0.7 + srcIdx)));
+            setParameter(processor, "steerY" + suffix, (float) std::cos(time * (0.3 + srcIdx)) * 0.5f);
+            setParameter(processor, "width" + suffix, (float) (0.5 + 0.5 * std::sin(time * 0.2)));
+            setParameter(processor, "level" + suffix, (float) (5 * std::sin(time * 0.5 + srcIdx)));
+        }
+        setParameter(processor, "hpf", (float) (250 + 200 * std::sin(time * 0.1)));
+        if (crossed(configSwitchTime)) {
+            setParameter(processor, "config", URA_2ESTICK);
+        }
+        if (crossed(configBackTime)) {
+            setParameter(processor, "config", ULA_1ESTICK);
+        }
+        if (crossed(renderingModeTime)) {
+            setParameter(processor, "rendering", FRACTIONAL_DELAY);
+        }
+        setParameter(processor, "mute2", time > muteTime && time < silenceTime ? 1 : 0);
+
+        /** Blocks of any size up to the largest, noisy sources, the second one silent for a while to be gated */
+        const int blockSize = random.nextInt(largestBlockSize + 1);
+        buffer.setSize(buffer.getNumChannels(), blockSize, false, false, true);
+        buffer.clear();
+        for (auto srcIdx = 0; srcIdx < NUM_SOURCES; srcIdx++) {
+            if (srcIdx == 1 && time > silenceTime && time < clearImpulseResponseTime) {
+                continue;
+            }
+            for (auto sampleIdx = 0; sampleIdx < blockSize; sampleIdx++) {
+                buffer.setSample(srcIdx, sampleIdx, (random.nextFloat() - 0.5f) * 0.5f);
+            }
+        }
+
+        processor.processBlock(buffer, midi);
+
+        /** In real time, so that the background threads keep up as with an audio device */
+        numBlocks++;
+        numSamples += blockSize;
+        prevTime = time;
+        const auto dueTime = startTime + numSamples / sampleRate * 1e3;
+        const auto now = Time::getMillisecondCounterHiRes();
+        if (dueTime > now) {
+            Thread::sleep(roundToInt(dueTime - now));
+        }
+    }
+
+    processor.releaseResources();
+
+    std::cout << "No allocations on the audio thread in " << numBlocks << " blocks" << std::endl;
+    std::cout << processor.getDeadlineMonitor().getReport();
+    std::cout << processor.getQualityGovernor().getReport();
+    return 0;
+}